@@ -7,37 +7,145 @@
 #endif
 
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
 #include <string>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#endif
 
 
 namespace smart_pointer_nts
 {
 
+	/// <summary>
+	/// compile time configuration of reference counter.
+	/// Bits: width of reference counts (8, 16, 32 or 64).
+	/// WeakSupport: if false, counter has no observer count and weak pointer cannot be used.
+	/// OverflowCheck: if true, increasing a count beyond its width throws std::overflow_error.
+	/// DeferredCounting: if true, shared pointers record count updates in deferred_rc_scope while it is active.
+	/// the largest count is reserved for immortal counter.
+	/// </summary>
+	template <unsigned Bits = 32, bool WeakSupport = true, bool OverflowCheck = false, bool DeferredCounting = false>
+	struct counter_policy
+	{
+		static_assert(Bits == 8 || Bits == 16 || Bits == 32 || Bits == 64, "counter width must be 8, 16, 32 or 64 bits.");
+		static_assert(!(OverflowCheck && DeferredCounting), "deferred counts cannot be checked for overflow, since they are applied in destructor.");
+
+		/// <summary>
+		/// type of reference counts.
+		/// </summary>
+		using count_type =
+			typename std::conditional<Bits == 8, std::uint8_t,
+			typename std::conditional<Bits == 16, std::uint16_t,
+			typename std::conditional<Bits == 32, std::uint32_t, std::uint64_t>::type>::type>::type;
+
+		static constexpr bool weak_support = WeakSupport;
+		static constexpr bool overflow_check = OverflowCheck;
+		static constexpr bool deferred_counting = DeferredCounting;
+	};
+
+	/// <summary>
+	/// counter policy of shared pointers whose counts can be deferred.
+	/// </summary>
+	using deferred_counter_policy = counter_policy<32, true, false, true>;
+
+
+	/// <summary>
+	/// tag for shared pointer of an object which lives longer than any owner.
+	/// </summary>
+	struct immortal_t
+	{
+	};
+	constexpr immortal_t immortal{};
+
+
+	/// <summary>
+	/// storage of reference counts.
+	/// </summary>
+	template <class Policy, bool WeakSupport = Policy::weak_support>
+	struct RefCountStorage
+	{
+		/// <summary>
+		/// reference count for shared pointer.
+		/// </summary>
+		typename Policy::count_type sref_count;
+
+		/// <summary>
+		/// refrence count for weak pointer.
+		/// </summary>
+		typename Policy::count_type wref_count;
+	};
+
+	/// <summary>
+	/// storage of reference counts without weak pointer support.
+	/// </summary>
+	template <class Policy>
+	struct RefCountStorage<Policy, false>
+	{
+		/// <summary>
+		/// reference count for shared pointer.
+		/// </summary>
+		typename Policy::count_type sref_count;
+	};
+
+
 	/// <summary>
 	/// reference count container.
 	/// this object must be disposed just after not having had owner and observer.
 	/// </summary>
-	class SharedPtrRefCounter
+	template <class Policy>
+	class BasicSharedPtrRefCounter : private RefCountStorage<Policy>
 	{
 	public:
-		template <class T, class U>friend class shared_ptr;
-		template <class T>friend class weak_ptr;
+		template <class T, class U, class P>friend class shared_ptr;
+		template <class T, class P>friend class weak_ptr;
+		template <class T, class U, class P>friend class shared_ptr_array;
+		friend class cycle_collector;
+		friend class AccesserForFactory;
+		friend class rc_buffer;
+		template <class P> friend class deferred_rc_scope;
+		template <class T> friend class object_pool;
+
+		using count_type = typename Policy::count_type;
+
+		/// <summary>
+		/// owner count of immortal counter, which is never written.
+		/// </summary>
+		static constexpr count_type immortal_count = std::numeric_limits<count_type>::max();
 
 	private:
 		/// <summary>
 		/// constructor.
 		/// </summary>
-		SharedPtrRefCounter(void* resource)
-			: sref_count(1)
-			, wref_count(0)
-			, resource(resource)
+		BasicSharedPtrRefCounter([[maybe_unused]] void* resource)
+#ifdef SMART_POINTER_NTS_PRINT_LOG
+			: resource(resource)
+#endif
 		{
+			this->sref_count = 1;
+			if constexpr (Policy::weak_support)
+				this->wref_count = 0;
+
 			SMART_POINTER_NTS_LOG("create counter " + std::to_string((unsigned long)this) + " for " + std::to_string((unsigned long)resource));
 		}
 
-		~SharedPtrRefCounter()
+		~BasicSharedPtrRefCounter()
 		{
 			SMART_POINTER_NTS_LOG("delete counter: " + std::to_string((unsigned long)this) + " for " + std::to_string((unsigned long)resource));
 		}
@@ -45,41 +153,75 @@ namespace smart_pointer_nts
 		/// <summary>
 		/// increase ref count.
 		/// </summary>
-		int IncreaseOwner()
+		count_type IncreaseOwner()
 		{
-			++sref_count;
-			SMART_POINTER_NTS_LOG("update ref: owner=" + std::to_string(sref_count) + ", observer=" + std::to_string(wref_count) + " for " + std::to_string((unsigned long)resource));
-			return sref_count;
+			return IncreaseOwner(1);
 		}
 
 		/// <summary>
 		/// decrease ref count.
 		/// </summary>
-		int DecreaseOwner()
+		count_type DecreaseOwner()
+		{
+			return DecreaseOwner(1);
+		}
+
+		/// <summary>
+		/// increase ref count by several owners at once.
+		/// </summary>
+		count_type IncreaseOwner(count_type count)
+		{
+			if (IsImmortal())
+				return this->sref_count;
+
+			CheckOverflow(this->sref_count, count);
+			this->sref_count += count;
+			LogUpdate();
+			return this->sref_count;
+		}
+
+		/// <summary>
+		/// decrease ref count by several owners at once.
+		/// </summary>
+		count_type DecreaseOwner(count_type count)
 		{
-			--sref_count;
-			SMART_POINTER_NTS_LOG("update ref: owner=" + std::to_string(sref_count) + ", observer=" + std::to_string(wref_count) + " for " + std::to_string((unsigned long)resource));
-			return sref_count;
+			if (IsImmortal())
+				return this->sref_count;
+
+			this->sref_count -= count;
+			LogUpdate();
+			return this->sref_count;
 		}
 
 		/// <summary>
 		/// increase ref count.
 		/// </summary>
-		int IncreaseObserver()
+		count_type IncreaseObserver()
 		{
-			++wref_count;
-			SMART_POINTER_NTS_LOG("update ref: owner=" + std::to_string(sref_count) + ", observer=" + std::to_string(wref_count) + " for " + std::to_string((unsigned long)resource));
-			return wref_count;
+			static_assert(Policy::weak_support, "weak pointer is not supported by counter policy.");
+
+			if (IsImmortal())
+				return this->wref_count;
+
+			CheckOverflow(this->wref_count, 1);
+			++this->wref_count;
+			LogUpdate();
+			return this->wref_count;
 		}
 
 		/// <summary>
 		/// decrease ref count.
 		/// </summary>
-		int DecreaseObserver()
+		count_type DecreaseObserver()
 		{
-			--wref_count;
-			SMART_POINTER_NTS_LOG("update ref: owner=" + std::to_string(sref_count) + ", observer=" + std::to_string(wref_count) + " for " + std::to_string((unsigned long)resource));
-			return wref_count;
+			static_assert(Policy::weak_support, "weak pointer is not supported by counter policy.");
+
+			if (IsImmortal())
+				return this->wref_count;
+
+			--this->wref_count;
+			LogUpdate();
+			return this->wref_count;
 		}
 
 		/// <summary>
@@ -87,7 +229,7 @@ namespace smart_pointer_nts
 		/// </summary>
 		long CountOwners() const
 		{
-			return sref_count;
+			return this->sref_count;
 		}
 
 		/// <summary>
@@ -95,34 +237,204 @@ namespace smart_pointer_nts
 		/// </summary>
 		long CountObservers() const
 		{
-			return wref_count;
+			if constexpr (Policy::weak_support)
+				return this->wref_count;
+			else
+				return 0;
 		}
 
+		/// <summary>
+		/// create counter at the head of a block followed by storage for a resource.
+		/// the whole block is deallocated with counter.
+		/// </summary>
+		static BasicSharedPtrRefCounter* CreateWithStorage(size_t size, size_t alignment, void*& storage)
+		{
+			size_t offset = sizeof(BasicSharedPtrRefCounter);
+			if (size > std::numeric_limits<size_t>::max() - offset - (alignment - 1))
+				throw std::bad_array_new_length();
+
+			size_t total;
+			if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			{
+				offset = (offset + alignment - 1) / alignment * alignment;
+				total = offset + size;
+			}
+			else
+			{
+				// over-aligned storage is aligned inside of the block, so that block is always deallocated in the same way.
+				total = offset + alignment - 1 + size;
+			}
+
+			char* block = static_cast<char*>(::operator new(total));
+			auto address = reinterpret_cast<std::uintptr_t>(block + offset);
+			storage = block + offset + (alignment - address % alignment) % alignment;
+
+			return new (block) BasicSharedPtrRefCounter(storage);
+		}
 
 		/// <summary>
-		/// reference count for shared pointer.
+		/// delete counter, and the block it heads.
+		/// </summary>
+		static void Destroy(BasicSharedPtrRefCounter* counter)
+		{
+			counter->~BasicSharedPtrRefCounter();
+			::operator delete(counter);
+		}
+
+		/// <summary>
+		/// dispose a resource whose owners are gone, and then delete counter if it has no observer.
+		/// resource is disposed first, because it may be placed in the same block as counter.
 		/// </summary>
-		int sref_count;
+		template <class Fn>
+		void DisposeResource(Fn&& dispose)
+		{
+			if constexpr (Policy::weak_support)
+			{
+				// keep counter while disposing, because the resource may have the last observer of itself.
+				++this->wref_count;
+				dispose();
+				if (--this->wref_count == 0)
+					Destroy(this);
+			}
+			else
+			{
+				dispose();
+				Destroy(this);
+			}
+		}
 
 		/// <summary>
-		/// refrence count for weak pointer.
+		/// make counter immortal. its counts are never written after this.
+		/// </summary>
+		void MakeImmortal()
+		{
+			this->sref_count = immortal_count;
+		}
+
+		/// <summary>
+		/// check if counter is immortal.
+		/// </summary>
+		bool IsImmortal() const
+		{
+			return this->sref_count == immortal_count;
+		}
+
+		/// <summary>
+		/// throw if adding to a count exceeds its width.
+		/// </summary>
+		static void CheckOverflow(count_type current, count_type count)
+		{
+			if constexpr (Policy::overflow_check)
+			{
+				if (count >= immortal_count - current)
+					throw std::overflow_error("reference count overflow");
+			}
+		}
+
+		/// <summary>
+		/// log current counts.
 		/// </summary>
-		int wref_count;
+		void LogUpdate() const
+		{
+			SMART_POINTER_NTS_LOG("update ref: owner=" + std::to_string(CountOwners()) + ", observer=" + std::to_string(CountObservers()) + " for " + std::to_string((unsigned long)resource));
+		}
 
+#ifdef SMART_POINTER_NTS_PRINT_LOG
 		/// <summary>
 		/// pointer managed by smart ptr.
-		/// currently used only for log.
+		/// used only for log.
 		/// </summary>
 		const void* const resource;
+#endif
+
+	};
+
+	/// <summary>
+	/// reference counter with default policy.
+	/// </summary>
+	using SharedPtrRefCounter = BasicSharedPtrRefCounter<counter_policy<>>;
+
+
+	class cycle_tracer;
+	class cycle_collector;
+
+	template <class T0, class Policy>
+	class reserved_unique_ptr;
+
+	template <class Policy>
+	class deferred_rc_scope;
+
+	/// <summary>
+	/// check if a type is collectable by cycle_collector.
+	/// a type is registered by having member function "void trace(cycle_tracer&)",
+	/// which passes every shared pointer and weak pointer member to the tracer.
+	/// </summary>
+	template <class T, class = void>
+	struct is_cycle_collectable : std::false_type
+	{
+	};
+
+	template <class T>
+	struct is_cycle_collectable<T, decltype(std::declval<T&>().trace(std::declval<cycle_tracer&>()))> : std::true_type
+	{
+	};
+
+	/// <summary>
+	/// buffer a possible root of garbage cycle.
+	/// </summary>
+	template <class T>
+	void PossibleCycleRoot(SharedPtrRefCounter* ref_count, T* resource);
+
+
+	/// <summary>
+	/// length of array managed by smart pointer.
+	/// it is 0 if unknown, such as array not made by factory functions.
+	/// </summary>
+	template <bool IsArray>
+	class ArrayLengthStorage
+	{
+	protected:
+		ArrayLengthStorage()
+			: length(0)
+		{
+		}
+
+		size_t GetLength() const
+		{
+			return this->length;
+		}
 
+		void SetLength(size_t value)
+		{
+			this->length = value;
+		}
+
+	private:
+		size_t length;
 	};
 
+	/// <summary>
+	/// length is not stored for non array.
+	/// </summary>
+	template <>
+	class ArrayLengthStorage<false>
+	{
+	protected:
+		size_t GetLength() const
+		{
+			return 0;
+		}
+
+		void SetLength(size_t)
+		{
+		}
+	};
 
 	/// <summary>
 	/// abstract smart pointer class with non thread safe.
 	/// </summary>
 	template <class T0, class Dt>
-	class smart_ptr_nts
+	class smart_ptr_nts : protected ArrayLengthStorage<std::is_array<T0>::value>
 	{
 	public:
 		using T = typename std::remove_extent<T0>::type;
@@ -154,6 +466,7 @@ namespace smart_pointer_nts
 		{
 			this->deleter = target.deleter;
 			this->rawPtr = target.rawPtr;
+			this->SetLength(target.GetLength());
 		}
 
 		/// <summary>
@@ -161,11 +474,13 @@ namespace smart_pointer_nts
 		/// </summary>
 		smart_ptr_nts(smart_ptr_nts&& target) noexcept
 		{
-			this->deleter = target.deleter;
+			this->deleter = std::move(target.deleter);
 			this->rawPtr = target.rawPtr;
+			this->SetLength(target.GetLength());
 
 			target.deleter = nullptr;
 			target.rawPtr = nullptr;
+			target.SetLength(0);
 		}
 
 		/// <summary>
@@ -193,6 +508,7 @@ namespace smart_pointer_nts
 			Dispose();
 			this->rawPtr = target.rawPtr;
 			this->deleter = target.deleter;
+			this->SetLength(target.GetLength());
 
 			return *this;
 		}
@@ -204,10 +520,12 @@ namespace smart_pointer_nts
 		{
 			Dispose();
 			this->rawPtr = target.rawPtr;
-			this->deleter = target.deleter;
+			this->deleter = std::move(target.deleter);
+			this->SetLength(target.GetLength());
 
 			target.rawPtr = nullptr;
 			target.deleter = nullptr;
+			target.SetLength(0);
 
 			return *this;
 		}
@@ -239,6 +557,14 @@ namespace smart_pointer_nts
 				this->deleter = deleter;
 		}
 
+		/// <summary>
+		/// get deleter.
+		/// </summary>
+		const Dt& GetDeleter() const
+		{
+			return this->deleter;
+		}
+
 		/// <summary>
 		/// disable deleter for keeping a managing resource.
 		/// </summary>
@@ -260,6 +586,7 @@ namespace smart_pointer_nts
 			}
 			this->rawPtr = nullptr;
 			this->deleter = nullptr;
+			this->SetLength(0);
 		}
 
 		/// <summary>
@@ -386,6 +713,34 @@ namespace smart_pointer_nts
 			return this->Get();
 		}
 
+		/// <summary>
+		/// get deleter.
+		/// </summary>
+		const Dt& get_deleter() const
+		{
+			return this->GetDeleter();
+		}
+
+		/// <summary>
+		/// get length of managing array. it is 0 for array not made by factory functions.
+		/// </summary>
+		template <class U = T0>
+		auto size() const -> typename std::enable_if<std::is_same<T0, U>::value && std::is_array<T0>::value, size_t>::type
+		{
+			return this->GetLength();
+		}
+
+#ifdef __cpp_lib_span
+		/// <summary>
+		/// get managing array as span.
+		/// </summary>
+		template <class U = T0>
+		auto span() const -> typename std::enable_if<std::is_same<T0, U>::value && std::is_array<T0>::value, std::span<T>>::type
+		{
+			return std::span<T>(this->get(), this->GetLength());
+		}
+#endif
+
 		/// <summary>
 		/// dispose current resource, and set null.
 		/// </summary>
@@ -419,6 +774,22 @@ namespace smart_pointer_nts
 				SMART_POINTER_NTS_LOG("retain resource: " + std::to_string((unsigned long)ptr) + " with unique ptr");
 		}
 
+		/// <summary>
+		/// give up managing resource without disposing it, and set null.
+		/// </summary>
+		T* release()
+		{
+			T* result = this->get();
+			this->DisableDisposing();
+			SmartPtrBase::reset();
+			if (result)
+				SMART_POINTER_NTS_LOG("release ownership: " + std::to_string((unsigned long)result) + " with unique ptr");
+
+			return result;
+		}
+
+		friend class AccesserForFactory;
+
 	private:
 		/// <summary>
 		/// dispose resource.
@@ -452,12 +823,13 @@ namespace smart_pointer_nts
 	/// <summary>
 	/// non thread safe shared pointer class.
 	/// </summary>
-	template <class T0, class Dt = std::function<void(void*)>>
+	template <class T0, class Dt = std::function<void(void*)>, class Policy = counter_policy<>>
 	class shared_ptr : public smart_ptr_nts<T0, Dt>
 	{
 	public:
 		using T = typename std::remove_extent<T0>::type;
 		using SmartPtrBase = smart_ptr_nts<T0, Dt>;
+		using RefCounter = BasicSharedPtrRefCounter<Policy>;
 
 		/// <summary>
 		/// constructor with nullptr.
@@ -490,15 +862,51 @@ namespace smart_pointer_nts
 				ref_count = CreateCounter(ptr);
 		}
 
+		/// <summary>
+		/// constructor taking over resource and deleter of unique pointer.
+		/// </summary>
+		shared_ptr(unique_ptr<T0, Dt>&& target)
+			: SmartPtrBase()
+			, ref_count(nullptr)
+		{
+			if (target.get())
+			{
+				ref_count = CreateCounter(target.get());
+				SmartPtrBase::operator=(std::move(target));
+			}
+		}
+
+		/// <summary>
+		/// constructor taking over unique pointer whose counter is reserved, without allocation.
+		/// </summary>
+		shared_ptr(reserved_unique_ptr<T0, Policy>&& target)
+			: SmartPtrBase()
+			, ref_count(nullptr)
+		{
+			if (T* raw_ptr = target.get())
+			{
+				ref_count = target.Detach();
+				SmartPtrBase::reset(raw_ptr, Dt(&DestroyReserved));
+			}
+		}
+
+		/// <summary>
+		/// constructor for an object which lives longer than any owner.
+		/// copies and destructions never write counter, and the object is never deleted.
+		/// </summary>
+		shared_ptr(T* ptr, immortal_t)
+			: SmartPtrBase(ptr, Dt())
+			, ref_count(ptr ? ImmortalCounter() : nullptr)
+		{
+		}
+
 		/// <summary>
 		/// copy constructor.
 		/// </summary>
 		shared_ptr(const shared_ptr& target)
-			: SmartPtrBase(target)
+			: SmartPtrBase(AcquireOwner(target))
 			, ref_count(target.ref_count)
 		{
-			if(ref_count)
-				ref_count->IncreaseOwner();
 		}
 
 		/// <summary>
@@ -532,15 +940,14 @@ namespace smart_pointer_nts
 		/// </summary>
 		shared_ptr& operator=(const shared_ptr& target)
 		{
-			if (this->ref_count == target.ref_count)
+			if (this->ref_count == target.ref_count && this->get() == target.get())
 				return *this;
 
+			AcquireOwner(target);
 			Dispose();
 			SmartPtrBase::operator=(target);
-			if (this->ref_count = target.ref_count)
-			{
-				ref_count->IncreaseOwner();
-			}
+			this->ref_count = target.ref_count;
+
 			return *this;
 		}
 
@@ -559,6 +966,22 @@ namespace smart_pointer_nts
 			return *this;
 		}
 
+		/// <summary>
+		/// assignment taking over resource and deleter of unique pointer.
+		/// </summary>
+		shared_ptr& operator=(unique_ptr<T0, Dt>&& target)
+		{
+			return operator=(shared_ptr(std::move(target)));
+		}
+
+		/// <summary>
+		/// assignment taking over unique pointer whose counter is reserved, without allocation.
+		/// </summary>
+		shared_ptr& operator=(reserved_unique_ptr<T0, Policy>&& target)
+		{
+			return operator=(shared_ptr(std::move(target)));
+		}
+
 		/// <summary>
 		/// calling members of a managing resource.
 		/// </summary>
@@ -585,6 +1008,34 @@ namespace smart_pointer_nts
 			return this->Get();
 		}
 
+		/// <summary>
+		/// get deleter.
+		/// </summary>
+		const Dt& get_deleter() const
+		{
+			return this->GetDeleter();
+		}
+
+		/// <summary>
+		/// get length of managing array. it is 0 for array not made by factory functions.
+		/// </summary>
+		template <class U = T0>
+		auto size() const -> typename std::enable_if<std::is_same<T0, U>::value && std::is_array<T0>::value, size_t>::type
+		{
+			return this->GetLength();
+		}
+
+#ifdef __cpp_lib_span
+		/// <summary>
+		/// get managing array as span.
+		/// </summary>
+		template <class U = T0>
+		auto span() const -> typename std::enable_if<std::is_same<T0, U>::value && std::is_array<T0>::value, std::span<T>>::type
+		{
+			return std::span<T>(this->get(), this->GetLength());
+		}
+#endif
+
 		/// <summary>
 		/// dispose current resource, and set null.
 		/// </summary>
@@ -625,7 +1076,14 @@ namespace smart_pointer_nts
 		{
 			long result = 0;
 			if (ref_count)
+			{
 				result = ref_count->CountOwners();
+				if constexpr (Policy::deferred_counting)
+				{
+					if (auto scope = deferred_rc_scope<Policy>::current)
+						result += static_cast<long>(scope->Pending(ref_count));
+				}
+			}
 
 			return result;
 		}
@@ -635,35 +1093,99 @@ namespace smart_pointer_nts
 		/// </summary>
 		class AccesserForWeakPtr
 		{
-			template <class U>
+			template <class U, class P>
 			friend class weak_ptr;
 
 		private:
-			static SharedPtrRefCounter* GetRefCounter(shared_ptr<T0>& obj)
+			static RefCounter* GetRefCounter(shared_ptr& obj)
 			{
 				return obj.ref_count;
 			}
-			static shared_ptr<T0> CreateFrom(T* raw_ptr, SharedPtrRefCounter* ref_count)
+			static shared_ptr CreateFrom(T* raw_ptr, RefCounter* ref_count, const Dt& deleter, size_t length)
 			{
+				shared_ptr result;
 				if (raw_ptr && ref_count && ref_count->CountOwners())
-					return shared_ptr<T0>(raw_ptr, ref_count);
-				else
-					return shared_ptr<T0>();
-			}
+				{
+					result = shared_ptr(raw_ptr, ref_count, deleter);
+					result.SetLength(length);
+				}
+
+				return result;
+			}
 
 		};
 		friend class AccesserForWeakPtr;
+		template <class U, class Et, class P> friend class shared_ptr_array;
+		template <class U> friend class slot_pool;
+		friend class cycle_tracer;
+		friend class AccesserForFactory;
 
 	private:
+		/// <summary>
+		/// tag for adopting an owner of existing counter.
+		/// </summary>
+		struct AdoptOwner
+		{
+		};
+
+		/// <summary>
+		/// contractor adopting an owner of existing counter.
+		/// </summary>
+		shared_ptr(T* raw_ptr, RefCounter* ref_count, const Dt& deleter, AdoptOwner)
+			: SmartPtrBase(raw_ptr, deleter)
+			, ref_count(ref_count)
+		{
+		}
+
+		/// <summary>
+		/// contractor from pointer and existing counter with deleter.
+		/// </summary>
+		shared_ptr(T* raw_ptr, RefCounter* ref_count, const Dt& deleter)
+			: SmartPtrBase(AcquireOwner(raw_ptr, ref_count), deleter)
+			, ref_count(ref_count)
+		{
+		}
+
 		/// <summary>
 		/// contractor from pointer
 		/// </summary>
-		shared_ptr(T* raw_ptr, SharedPtrRefCounter* ref_count)
-			: SmartPtrBase(raw_ptr)
+		shared_ptr(T* raw_ptr, RefCounter* ref_count)
+			: SmartPtrBase(AcquireOwner(raw_ptr, ref_count))
 			, ref_count(ref_count)
+		{
+		}
+
+		/// <summary>
+		/// increase owner of a copying target.
+		/// this is done before copying deleter, so that overflow exception does not dispose the resource.
+		/// </summary>
+		static const shared_ptr& AcquireOwner(const shared_ptr& target)
+		{
+			if (target.ref_count)
+			{
+				if constexpr (Policy::deferred_counting)
+				{
+					if (auto scope = deferred_rc_scope<Policy>::current)
+					{
+						scope->Acquire(target.ref_count);
+						return target;
+					}
+				}
+				target.ref_count->IncreaseOwner();
+			}
+
+			return target;
+		}
+
+		/// <summary>
+		/// increase owner of an existing counter.
+		/// </summary>
+		static T* AcquireOwner(T* raw_ptr, RefCounter* ref_count)
 		{
 			assert(raw_ptr && ref_count && ref_count->CountOwners());
 			ref_count->IncreaseOwner();
+
+			return raw_ptr;
 		}
 
 		/// <summary>
@@ -673,43 +1195,358 @@ namespace smart_pointer_nts
 		{
 			if (ref_count)
 			{
-				if (ref_count->DecreaseOwner() == 0)
+				auto released = this->ref_count;
+				this->ref_count = nullptr;
+				if constexpr (Policy::deferred_counting)
 				{
-					if (ref_count->CountObservers() == 0)
-						delete this->ref_count;
+					if (auto scope = deferred_rc_scope<Policy>::current)
+					{
+						// disposing is deferred to the end of scope with a copy of deleter.
+						scope->Release(released, this->get(), this->get_deleter());
+						this->DisableDisposing();
+						return;
+					}
+				}
 
-					// a managing resource will be disposed by base disposer.
+				if (released->DecreaseOwner() == 0)
+				{
+					// a managing resource is disposed by base disposer.
+					released->DisposeResource([this]() { SmartPtrBase::reset(); });
 				}
 				else
 				{
+					if constexpr (is_cycle_collectable<T>::value && std::is_same<Policy, counter_policy<>>::value)
+						PossibleCycleRoot(released, this->get());
+
 					// has owner(s), thus not disposing yet.
 					this->DisableDisposing();
 				}
-				this->ref_count = nullptr;
 			}
 		}
 
+		/// <summary>
+		/// deleter of an object placed in the block of its reserved counter.
+		/// </summary>
+		static void DestroyReserved(void* obj)
+		{
+			static_cast<T*>(obj)->~T();
+		}
+
 		/// <summary>
 		/// create counter object.
 		/// </summary>
-		static SharedPtrRefCounter* CreateCounter(void* resource)
+		static RefCounter* CreateCounter(void* resource)
 		{
 			SMART_POINTER_NTS_LOG("retain resource: " + std::to_string((unsigned long)resource) + " with shared ptr");
-			return new SharedPtrRefCounter(resource);
+			return new RefCounter(resource);
+		}
+
+		/// <summary>
+		/// get counter shared by all of immortal objects.
+		/// </summary>
+		static RefCounter* ImmortalCounter()
+		{
+			static RefCounter* counter = CreateImmortalCounter();
+			return counter;
+		}
+
+		/// <summary>
+		/// create counter shared by all of immortal objects. it is never deleted.
+		/// </summary>
+		static RefCounter* CreateImmortalCounter()
+		{
+			RefCounter* counter = new RefCounter(nullptr);
+			counter->MakeImmortal();
+			return counter;
 		}
 
 		/// <summary>
 		/// reference counter.
 		/// </summary>
-		SharedPtrRefCounter* ref_count;
+		RefCounter* ref_count;
+
+	};
+
+	/// <summary>
+	/// make shared pointer of an object which lives longer than any owner, such as static object.
+	/// </summary>
+	template <class T, class Policy = counter_policy<>>
+	shared_ptr<T, std::function<void(void*)>, Policy> make_immortal_shared(T& obj)
+	{
+		return shared_ptr<T, std::function<void(void*)>, Policy>(&obj, immortal);
+	}
+
+	/// <summary>
+	/// accesser class for factory functions making shared pointer
+	/// whose counter is allocated together with other storage.
+	/// </summary>
+	class AccesserForFactory
+	{
+	public:
+		/// <summary>
+		/// create counter at the head of a block followed by storage.
+		/// </summary>
+		template <class Policy>
+		static BasicSharedPtrRefCounter<Policy>* CreateWithStorage(size_t size, size_t alignment, void*& storage)
+		{
+			SMART_POINTER_NTS_LOG("retain resource with shared ptr, allocated together with counter");
+			return BasicSharedPtrRefCounter<Policy>::CreateWithStorage(size, alignment, storage);
+		}
+
+		/// <summary>
+		/// delete counter which has not been owned by shared pointer.
+		/// </summary>
+		template <class Policy>
+		static void Destroy(BasicSharedPtrRefCounter<Policy>* ref_count)
+		{
+			BasicSharedPtrRefCounter<Policy>::Destroy(ref_count);
+		}
+
+		/// <summary>
+		/// get counter heading storage created by CreateWithStorage with alignment not exceeding default.
+		/// </summary>
+		template <class Policy>
+		static BasicSharedPtrRefCounter<Policy>* CounterOfStorage(void* storage, size_t alignment)
+		{
+			assert(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+			size_t offset = (sizeof(BasicSharedPtrRefCounter<Policy>) + alignment - 1) / alignment * alignment;
+
+			return reinterpret_cast<BasicSharedPtrRefCounter<Policy>*>(static_cast<char*>(storage) - offset);
+		}
+
+		/// <summary>
+		/// count owners of counter.
+		/// </summary>
+		template <class Policy>
+		static long CountOwners(const BasicSharedPtrRefCounter<Policy>* ref_count)
+		{
+			return ref_count->CountOwners();
+		}
+
+		/// <summary>
+		/// count observers of counter.
+		/// </summary>
+		template <class Policy>
+		static long CountObservers(const BasicSharedPtrRefCounter<Policy>* ref_count)
+		{
+			return ref_count->CountObservers();
+		}
+
+		/// <summary>
+		/// make shared pointer adopting an owner of counter.
+		/// </summary>
+		template <class T0, class Dt, class Policy>
+		static shared_ptr<T0, Dt, Policy> Adopt(typename shared_ptr<T0, Dt, Policy>::T* raw_ptr, BasicSharedPtrRefCounter<Policy>* ref_count, const Dt& deleter)
+		{
+			return shared_ptr<T0, Dt, Policy>(raw_ptr, ref_count, deleter, typename shared_ptr<T0, Dt, Policy>::AdoptOwner());
+		}
+
+		/// <summary>
+		/// make shared pointer adding an owner to counter.
+		/// </summary>
+		template <class T0, class Dt, class Policy>
+		static shared_ptr<T0, Dt, Policy> Share(typename shared_ptr<T0, Dt, Policy>::T* raw_ptr, BasicSharedPtrRefCounter<Policy>* ref_count, const Dt& deleter)
+		{
+			return shared_ptr<T0, Dt, Policy>(raw_ptr, ref_count, deleter);
+		}
+
+		/// <summary>
+		/// get counter of shared pointer.
+		/// </summary>
+		template <class T0, class Dt, class Policy>
+		static BasicSharedPtrRefCounter<Policy>* GetRefCounter(const shared_ptr<T0, Dt, Policy>& target)
+		{
+			return target.ref_count;
+		}
+
+		/// <summary>
+		/// deleter destroying an object without deallocating its storage.
+		/// </summary>
+		template <class T>
+		static void DestroyInPlace(void* obj)
+		{
+			static_cast<T*>(obj)->~T();
+		}
+
+		/// <summary>
+		/// set length of array made by factory.
+		/// </summary>
+		template <class Ptr>
+		static void SetLength(Ptr& target, size_t length)
+		{
+			target.SetLength(length);
+		}
+
+		/// <summary>
+		/// get bytes of array, or throw if it is too long.
+		/// </summary>
+		template <class T>
+		static size_t ArrayBytes(size_t length)
+		{
+			if (length > std::numeric_limits<size_t>::max() / sizeof(T))
+				throw std::bad_array_new_length();
+
+			return sizeof(T) * length;
+		}
+
+		/// <summary>
+		/// construct elements of array in storage. elements are value initialized, or default initialized for overwrite.
+		/// </summary>
+		template <class T>
+		static T* ConstructArray(void* storage, size_t length, bool for_overwrite)
+		{
+			T* elements = static_cast<T*>(storage);
+			if (for_overwrite && std::is_trivially_default_constructible<T>::value)
+				return elements;
+
+			size_t constructed = 0;
+			try
+			{
+				for (; constructed < length; ++constructed)
+				{
+					if (for_overwrite)
+						new (elements + constructed) T;
+					else
+						new (elements + constructed) T();
+				}
+			}
+			catch (...)
+			{
+				DestroyArray(elements, constructed);
+				throw;
+			}
+
+			return elements;
+		}
+
+		/// <summary>
+		/// destroy elements of array in reverse order without deallocating its storage.
+		/// </summary>
+		template <class T>
+		static void DestroyArray(T* elements, size_t length)
+		{
+			if constexpr (!std::is_trivially_destructible<T>::value)
+			{
+				while (length)
+					elements[--length].~T();
+			}
+		}
+
+		/// <summary>
+		/// make shared pointer of a new array. the array and its counter are allocated at once.
+		/// </summary>
+		template <class T>
+		static shared_ptr<T> MakeSharedArray(size_t length, bool for_overwrite)
+		{
+			using E = typename std::remove_extent<T>::type;
+
+			void* storage;
+			auto ref_count = CreateWithStorage<counter_policy<>>(ArrayBytes<E>(length), alignof(E), storage);
+
+			E* elements;
+			try
+			{
+				elements = ConstructArray<E>(storage, length, for_overwrite);
+			}
+			catch (...)
+			{
+				Destroy(ref_count);
+				throw;
+			}
+
+			auto result = Adopt<T, std::function<void(void*)>, counter_policy<>>(elements, ref_count, [length](void* obj) { DestroyArray(static_cast<E*>(obj), length); });
+			result.SetLength(length);
+
+			return result;
+		}
+
+		/// <summary>
+		/// make unique pointer of a new array allocated by new[], so that a released array can be deleted by delete[].
+		/// </summary>
+		template <class T>
+		static unique_ptr<T> MakeUniqueArray(size_t length, bool for_overwrite)
+		{
+			using E = typename std::remove_extent<T>::type;
+
+			unique_ptr<T> result(for_overwrite ? new E[length] : new E[length]());
+			result.SetLength(length);
 
+			return result;
+		}
 	};
 
+	/// <summary>
+	/// make shared pointer of a new object. the object and its counter are allocated at once.
+	/// </summary>
+	template <class T, class... Args>
+	auto make_shared(Args&&... args) -> typename std::enable_if<!std::is_array<T>::value, shared_ptr<T>>::type
+	{
+		void* storage;
+		auto ref_count = AccesserForFactory::CreateWithStorage<counter_policy<>>(sizeof(T), alignof(T), storage);
+
+		T* obj;
+		try
+		{
+			obj = new (storage) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			AccesserForFactory::Destroy(ref_count);
+			throw;
+		}
+		return AccesserForFactory::Adopt<T, std::function<void(void*)>, counter_policy<>>(obj, ref_count, &AccesserForFactory::DestroyInPlace<T>);
+	}
+
+	/// <summary>
+	/// make shared pointer of a new array of value initialized elements. the array and its counter are allocated at once.
+	/// </summary>
+	template <class T>
+	auto make_shared(size_t length) -> typename std::enable_if<std::is_array<T>::value && std::extent<T>::value == 0, shared_ptr<T>>::type
+	{
+		return AccesserForFactory::MakeSharedArray<T>(length, false);
+	}
+
+	/// <summary>
+	/// make shared pointer of a new array of default initialized elements, which are to be overwritten.
+	/// </summary>
+	template <class T>
+	auto make_shared_for_overwrite(size_t length) -> typename std::enable_if<std::is_array<T>::value && std::extent<T>::value == 0, shared_ptr<T>>::type
+	{
+		return AccesserForFactory::MakeSharedArray<T>(length, true);
+	}
+
+	/// <summary>
+	/// make unique pointer of a new object.
+	/// </summary>
+	template <class T, class... Args>
+	auto make_unique(Args&&... args) -> typename std::enable_if<!std::is_array<T>::value, unique_ptr<T>>::type
+	{
+		return unique_ptr<T>(new T(std::forward<Args>(args)...));
+	}
+
+	/// <summary>
+	/// make unique pointer of a new array of value initialized elements.
+	/// </summary>
+	template <class T>
+	auto make_unique(size_t length) -> typename std::enable_if<std::is_array<T>::value && std::extent<T>::value == 0, unique_ptr<T>>::type
+	{
+		return AccesserForFactory::MakeUniqueArray<T>(length, false);
+	}
+
+	/// <summary>
+	/// make unique pointer of a new array of default initialized elements, which are to be overwritten.
+	/// </summary>
+	template <class T>
+	auto make_unique_for_overwrite(size_t length) -> typename std::enable_if<std::is_array<T>::value && std::extent<T>::value == 0, unique_ptr<T>>::type
+	{
+		return AccesserForFactory::MakeUniqueArray<T>(length, true);
+	}
+
 	/// <summary>
 	/// compare managing resources.
 	/// </summary>
-	template  <class T, class M>
-	bool operator==(shared_ptr<T>& target1, shared_ptr<M>& target2)
+	template  <class T, class Dt, class P, class M, class Et, class Q>
+	bool operator==(shared_ptr<T, Dt, P>& target1, shared_ptr<M, Et, Q>& target2)
 	{
 		return target1.get() == target2.get();
 	}
@@ -717,8 +1554,8 @@ namespace smart_pointer_nts
 	/// <summary>
 	/// check if it is null.
 	/// </summary>
-	template  <class T>
-	bool operator==(shared_ptr<T>& target, nullptr_t)
+	template  <class T, class Dt, class P>
+	bool operator==(shared_ptr<T, Dt, P>& target, nullptr_t)
 	{
 		return !target.get();
 	}
@@ -726,13 +1563,17 @@ namespace smart_pointer_nts
 	
 	/// <summary>
 	/// non thread safe weak pointer class.
+	/// deleter of the owner is kept for locking, but never called by weak pointer.
 	/// </summary>
-	template <class T0>
+	template <class T0, class Policy = counter_policy<>>
 	class weak_ptr : public smart_ptr_nts<T0, std::function<void(void*)>>
 	{
+		static_assert(Policy::weak_support, "weak pointer is not supported by counter policy.");
+
 	public:
 		using T = typename std::remove_extent<T0>::type;
 		using SmartPtrBase = smart_ptr_nts<T0, std::function<void(void*)>>;
+		using RefCounter = BasicSharedPtrRefCounter<Policy>;
 
 		/// <summary>
 		/// constructor with nullptr.
@@ -747,10 +1588,12 @@ namespace smart_pointer_nts
 		/// constructor with shared pointer.
 		/// </summary>
 		template <class Dt>
-		weak_ptr(shared_ptr<T0, Dt>& sharedPtr)
-			: SmartPtrBase(sharedPtr.get(), nullptr)
-			, ref_count(shared_ptr<T0, Dt>::AccesserForWeakPtr::GetRefCounter(sharedPtr))
+		weak_ptr(shared_ptr<T0, Dt, Policy>& sharedPtr)
+			: SmartPtrBase(sharedPtr.get(), sharedPtr.get_deleter())
+			, ref_count(shared_ptr<T0, Dt, Policy>::AccesserForWeakPtr::GetRefCounter(sharedPtr))
 		{
+			if constexpr (std::is_array<T0>::value)
+				this->SetLength(sharedPtr.size());
 			if (ref_count)
 				ref_count->IncreaseObserver();
 		}
@@ -789,14 +1632,15 @@ namespace smart_pointer_nts
 		/// </summary>
 		weak_ptr& operator=(weak_ptr& target)
 		{
-			if (this->ref_count == target.ref_count)
+			if (this->ref_count == target.ref_count && this->Get() == target.Get())
 				return *this;
 
+			if (target.ref_count)
+				target.ref_count->IncreaseObserver();
+
 			Dispose();
 			SmartPtrBase::operator=(target);
-
-			if (this->ref_count = target.ref_count)
-				ref_count->IncreaseObserver();
+			this->ref_count = target.ref_count;
 
 			return *this;
 		}
@@ -804,9 +1648,10 @@ namespace smart_pointer_nts
 		/// <summary>
 		/// copy assignment from shared ptr.
 		/// </summary>
-		weak_ptr& operator=(shared_ptr<T0>& target)
+		template <class Dt>
+		weak_ptr& operator=(shared_ptr<T0, Dt, Policy>& target)
 		{
-			weak_ptr<T0> tmpForCopy(target);
+			weak_ptr tmpForCopy(target);
 			operator=(std::move(tmpForCopy));
 
 			return *this;
@@ -839,10 +1684,10 @@ namespace smart_pointer_nts
 		/// <summary>
 		/// try locking an observing pointer.
 		/// </summary>
-		shared_ptr<T0> lock()
+		shared_ptr<T0, std::function<void(void*)>, Policy> lock()
 		{
-			return shared_ptr<T0>::AccesserForWeakPtr::CreateFrom(
-				this->Get(), this->ref_count);
+			return shared_ptr<T0, std::function<void(void*)>, Policy>::AccesserForWeakPtr::CreateFrom(
+				this->Get(), this->ref_count, this->GetDeleter(), this->GetLength());
 		}
 
 		/// <summary>
@@ -863,12 +1708,15 @@ namespace smart_pointer_nts
 		/// </summary>
 		void Dispose()
 		{
+			// keeping deleter is only for locking.
+			this->DisableDisposing();
+
 			if (ref_count)
 			{
 				if (ref_count->DecreaseObserver() == 0)
 				{
 					if (ref_count->CountOwners() == 0)
-						delete this->ref_count;
+						RefCounter::Destroy(this->ref_count);
 				}
 				this->ref_count = nullptr;
 			}
@@ -877,60 +1725,5150 @@ namespace smart_pointer_nts
 		/// <summary>
 		/// reference counter.
 		/// </summary>
-		SharedPtrRefCounter* ref_count;
+		RefCounter* ref_count;
 
 	};
-}
 
-/// <summary>
-/// hash class implementation for nts shared ptr.
-/// </summary>
-template <class T>
-struct std::hash<smart_pointer_nts::unique_ptr<T>>
-{
-	std::size_t operator()(
-		const smart_pointer_nts::unique_ptr<T>& target) const noexcept
-	{
-		return std::hash<T*>()(target.get());
-	}
-};
 
-/// <summary>
-/// equal_to class implementation for nts shared ptr.
-/// </summary>
-template <class T>
-struct std::equal_to<smart_pointer_nts::unique_ptr<T>>
-{
-	constexpr bool operator ()(
-		smart_pointer_nts::unique_ptr<T>& target1,
-		smart_pointer_nts::unique_ptr<T>& target2) const
+	/// <summary>
+	/// non thread safe container of shared pointers stored as structure of arrays.
+	/// resources, counters and deleter indices are kept in parallel contiguous arrays,
+	/// and counters referred by elements are kept once in a table sorted by address with the number of references,
+	/// so that bulk operations update each counter only once however its elements are placed.
+	/// </summary>
+	template <class T0, class Dt = std::function<void(void*)>, class Policy = counter_policy<>>
+	class shared_ptr_array
 	{
-		return target1.get() == target2.get();
-	}
-};
+		static_assert(!Policy::deferred_counting, "shared_ptr_array does not support deferred counting.");
 
-/// <summary>
-/// hash class implementation for nts shared ptr.
-/// </summary>
-template <class T>
-struct std::hash<smart_pointer_nts::shared_ptr<T>>
-{
-	std::size_t operator()(
-		const smart_pointer_nts::shared_ptr<T>& target) const noexcept
-	{
-		return std::hash<T*>()(target.get());
-	}
-};
+	public:
+		using T = typename std::remove_extent<T0>::type;
+		using element_type = shared_ptr<T0, Dt, Policy>;
+		using RefCounter = BasicSharedPtrRefCounter<Policy>;
 
-/// <summary>
-/// equal_to class implementation for nts shared ptr.
-/// </summary>
+		/// <summary>
+		/// constructor with empty.
+		/// </summary>
+		shared_ptr_array()
+		{
+		}
+
+		/// <summary>
+		/// copy constructor. owners are increased once per counter.
+		/// </summary>
+		shared_ptr_array(const shared_ptr_array& target)
+			: objects(target.objects)
+			, counters(target.counters)
+			, deleter_ids(target.deleter_ids)
+			, blocks(target.blocks)
+			, deleters(target.deleters)
+			, deleter_keys(target.deleter_keys)
+		{
+			for (auto& block : blocks)
+				block.counter->IncreaseOwner(static_cast<typename RefCounter::count_type>(block.refs));
+		}
+
+		/// <summary>
+		/// move constructor.
+		/// </summary>
+		shared_ptr_array(shared_ptr_array&& target) noexcept
+			: objects(std::move(target.objects))
+			, counters(std::move(target.counters))
+			, deleter_ids(std::move(target.deleter_ids))
+			, blocks(std::move(target.blocks))
+			, deleters(std::move(target.deleters))
+			, deleter_keys(std::move(target.deleter_keys))
+		{
+			target.objects.clear();
+			target.counters.clear();
+			target.deleter_ids.clear();
+			target.blocks.clear();
+			target.deleters.clear();
+			target.deleter_keys.clear();
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~shared_ptr_array()
+		{
+			clear();
+		}
+
+		/// <summary>
+		/// copy assignment.
+		/// </summary>
+		shared_ptr_array& operator=(const shared_ptr_array& target)
+		{
+			if (this != &target)
+				operator=(shared_ptr_array(target));
+
+			return *this;
+		}
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		shared_ptr_array& operator=(shared_ptr_array&& target) noexcept
+		{
+			assert(this != &target);
+
+			clear();
+			objects = std::move(target.objects);
+			counters = std::move(target.counters);
+			deleter_ids = std::move(target.deleter_ids);
+			blocks = std::move(target.blocks);
+			deleters = std::move(target.deleters);
+			deleter_keys = std::move(target.deleter_keys);
+
+			target.objects.clear();
+			target.counters.clear();
+			target.deleter_ids.clear();
+			target.blocks.clear();
+			target.deleters.clear();
+			target.deleter_keys.clear();
+
+			return *this;
+		}
+
+		/// <summary>
+		/// count elements.
+		/// </summary>
+		size_t size() const
+		{
+			return objects.size();
+		}
+
+		/// <summary>
+		/// check if there is no element.
+		/// </summary>
+		bool empty() const
+		{
+			return objects.empty();
+		}
+
+		/// <summary>
+		/// reserve capacity for elements.
+		/// </summary>
+		void reserve(size_t capacity)
+		{
+			objects.reserve(capacity);
+			counters.reserve(capacity);
+			deleter_ids.reserve(capacity);
+		}
+
+		/// <summary>
+		/// get rew pointer of an element without touching its counter.
+		/// </summary>
+		T* get(size_t index) const
+		{
+			return objects[index];
+		}
+
+		/// <summary>
+		/// get contiguous array of rew pointers.
+		/// </summary>
+		T* const* data() const
+		{
+			return objects.data();
+		}
+
+		/// <summary>
+		/// get an element as shared pointer.
+		/// </summary>
+		element_type operator[](size_t index) const
+		{
+			if (counters[index])
+				return element_type(objects[index], counters[index], deleters[deleter_ids[index]]);
+			else
+				return element_type();
+		}
+
+		/// <summary>
+		/// get reference count of an element.
+		/// </summary>
+		long use_count(size_t index) const
+		{
+			long result = 0;
+			if (counters[index])
+				result = counters[index]->CountOwners();
+
+			return result;
+		}
+
+		/// <summary>
+		/// add an element.
+		/// </summary>
+		void push_back(const element_type& ptr)
+		{
+			std::uint32_t id = 0;
+			if (ptr.ref_count)
+			{
+				id = AddDeleter(ptr.GetDeleter());
+				AddBlock(ptr.ref_count, ptr.get(), id, 1);
+			}
+			objects.push_back(ptr.get());
+			counters.push_back(ptr.ref_count);
+			deleter_ids.push_back(id);
+			if (ptr.ref_count)
+				ptr.ref_count->IncreaseOwner();
+		}
+
+		/// <summary>
+		/// add an element taking over its ownership.
+		/// </summary>
+		void push_back(element_type&& ptr)
+		{
+			std::uint32_t id = 0;
+			if (ptr.ref_count)
+			{
+				id = AddDeleter(ptr.GetDeleter());
+				AddBlock(ptr.ref_count, ptr.get(), id, 1);
+			}
+			objects.push_back(ptr.get());
+			counters.push_back(ptr.ref_count);
+			deleter_ids.push_back(id);
+			if (ptr.ref_count)
+			{
+				ptr.ref_count = nullptr;
+				ptr.DisableDisposing();
+				ptr.SmartPtrBase::reset();
+			}
+		}
+
+		/// <summary>
+		/// add all elements of another array. owners are increased once per counter.
+		/// </summary>
+		void append(const shared_ptr_array& target)
+		{
+			if (this == &target)
+			{
+				append(shared_ptr_array(target));
+				return;
+			}
+
+			// deleters of target are merged into this array once, and then element indices are translated.
+			std::vector<std::uint32_t> translated;
+			translated.reserve(target.deleters.size());
+			for (auto& deleter : target.deleters)
+				translated.push_back(AddDeleter(deleter));
+
+			objects.insert(objects.end(), target.objects.begin(), target.objects.end());
+			counters.insert(counters.end(), target.counters.begin(), target.counters.end());
+			deleter_ids.reserve(objects.size());
+			for (size_t i = 0; i < target.size(); ++i)
+				deleter_ids.push_back(target.counters[i] ? translated[target.deleter_ids[i]] : 0);
+
+			for (auto& block : target.blocks)
+			{
+				AddBlock(block.counter, block.resource, translated[block.deleter_id], block.refs);
+				block.counter->IncreaseOwner(static_cast<typename RefCounter::count_type>(block.refs));
+			}
+		}
+
+		/// <summary>
+		/// copy a range of elements. owners are increased once per counter.
+		/// </summary>
+		shared_ptr_array slice(size_t first, size_t count) const
+		{
+			assert(first + count <= size());
+
+			shared_ptr_array result;
+			result.objects.assign(objects.begin() + first, objects.begin() + first + count);
+			result.counters.assign(counters.begin() + first, counters.begin() + first + count);
+			result.deleter_ids.assign(deleter_ids.begin() + first, deleter_ids.begin() + first + count);
+			if (count)
+			{
+				result.deleters = deleters;
+				result.deleter_keys = deleter_keys;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (result.counters[i])
+					result.AddBlock(result.counters[i], result.objects[i], result.deleter_ids[i], 1);
+			}
+			for (auto& block : result.blocks)
+				block.counter->IncreaseOwner(static_cast<typename RefCounter::count_type>(block.refs));
+
+			return result;
+		}
+
+		/// <summary>
+		/// release a range of elements. owners are decreased once per counter.
+		/// </summary>
+		void erase(size_t first, size_t count)
+		{
+			assert(first + count <= size());
+
+			// references released from each counter are summed up in its block, and then written at once.
+			for (size_t i = first; i < first + count; ++i)
+			{
+				if (counters[i])
+					++FindBlock(counters[i])->releasing;
+			}
+			for (size_t i = first; i < first + count; ++i)
+			{
+				if (counters[i])
+					ReleaseBlock(*FindBlock(counters[i]));
+			}
+			RemoveReleasedBlocks();
+
+			objects.erase(objects.begin() + first, objects.begin() + first + count);
+			counters.erase(counters.begin() + first, counters.begin() + first + count);
+			deleter_ids.erase(deleter_ids.begin() + first, deleter_ids.begin() + first + count);
+			if (objects.empty())
+				ClearDeleters();
+		}
+
+		/// <summary>
+		/// release all elements. owners are decreased once per counter.
+		/// </summary>
+		void clear()
+		{
+			auto releasing = std::move(blocks);
+			auto releasing_deleters = std::move(deleters);
+			objects.clear();
+			counters.clear();
+			deleter_ids.clear();
+			blocks.clear();
+			deleters.clear();
+			deleter_keys.clear();
+
+			for (auto& block : releasing)
+			{
+				block.releasing = block.refs;
+				ReleaseBlock(block, releasing_deleters);
+			}
+		}
+
+		/// <summary>
+		/// count null elements.
+		/// </summary>
+		size_t count_null() const
+		{
+			// branchless loop over contiguous pointers, so that compiler can vectorize it.
+			size_t result = 0;
+			const size_t length = objects.size();
+			T* const* first = objects.data();
+			for (size_t i = 0; i < length; ++i)
+				result += first[i] == nullptr;
+
+			return result;
+		}
+
+		/// <summary>
+		/// count elements whose resources are not owned by anyone but this array.
+		/// </summary>
+		size_t count_expired() const
+		{
+			size_t result = 0;
+			for (auto& block : blocks)
+			{
+				if (IsExpired(block))
+					result += block.refs;
+			}
+			return result;
+		}
+
+		/// <summary>
+		/// release null elements and elements whose resources are not owned by anyone but this array.
+		/// </summary>
+		void remove_expired()
+		{
+			for (auto& block : blocks)
+			{
+				if (IsExpired(block))
+					block.releasing = block.refs;
+			}
+
+			size_t kept = 0;
+			const size_t length = objects.size();
+			for (size_t i = 0; i < length; ++i)
+			{
+				if (!counters[i] || FindBlock(counters[i])->releasing)
+					continue;
+
+				objects[kept] = objects[i];
+				counters[kept] = counters[i];
+				deleter_ids[kept] = deleter_ids[i];
+				++kept;
+			}
+			objects.resize(kept);
+			counters.resize(kept);
+			deleter_ids.resize(kept);
+
+			for (auto& block : blocks)
+			{
+				if (block.releasing)
+					ReleaseBlock(block);
+			}
+			RemoveReleasedBlocks();
+			if (objects.empty())
+				ClearDeleters();
+		}
+
+	private:
+		/// <summary>
+		/// references of this array to a counter.
+		/// </summary>
+		struct Block
+		{
+			RefCounter* counter;
+			size_t refs;
+			size_t releasing;
+			T* resource;
+			std::uint32_t deleter_id;
+		};
+
+		/// <summary>
+		/// find block of a counter by binary search.
+		/// </summary>
+		typename std::vector<Block>::iterator LowerBound(RefCounter* counter)
+		{
+			return std::lower_bound(blocks.begin(), blocks.end(), counter,
+				[](const Block& block, RefCounter* value) { return std::less<RefCounter*>()(block.counter, value); });
+		}
+
+		/// <summary>
+		/// find block of a counter referred by an element.
+		/// </summary>
+		Block* FindBlock(RefCounter* counter)
+		{
+			auto found = LowerBound(counter);
+			assert(found != blocks.end() && found->counter == counter);
+			return &*found;
+		}
+
+		/// <summary>
+		/// register references to a counter.
+		/// </summary>
+		void AddBlock(RefCounter* counter, T* resource, std::uint32_t deleter_id, size_t refs)
+		{
+			auto found = LowerBound(counter);
+			if (found != blocks.end() && found->counter == counter)
+				found->refs += refs;
+			else
+				blocks.insert(found, Block{ counter, refs, 0, resource, deleter_id });
+		}
+
+		/// <summary>
+		/// check if a counter is owned by nobody but this array.
+		/// </summary>
+		static bool IsExpired(const Block& block)
+		{
+			return block.counter->CountOwners() == static_cast<long>(block.refs);
+		}
+
+		/// <summary>
+		/// decrease owners by references being released at once, and dispose a managing resource if needed.
+		/// </summary>
+		void ReleaseBlock(Block& block)
+		{
+			ReleaseBlock(block, deleters);
+		}
+
+		/// <summary>
+		/// release references of a block, disposing with deleters moved out of this array.
+		/// </summary>
+		static void ReleaseBlock(Block& block, const std::vector<Dt>& deleters)
+		{
+			if (!block.releasing)
+				return;
+
+			auto releasing = block.releasing;
+			block.refs -= releasing;
+			block.releasing = 0;
+			if (block.counter->DecreaseOwner(static_cast<typename RefCounter::count_type>(releasing)) == 0)
+			{
+				T* resource = block.resource;
+				const Dt& deleter = deleters[block.deleter_id];
+				block.counter->DisposeResource([resource, &deleter]()
+				{
+					if (deleter)
+					{
+						deleter(resource);
+						SMART_POINTER_NTS_LOG("release resource: " + std::to_string((unsigned long)resource));
+					}
+				});
+			}
+		}
+
+		/// <summary>
+		/// remove blocks which this array no longer refers.
+		/// </summary>
+		void RemoveReleasedBlocks()
+		{
+			blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [](const Block& block) { return block.refs == 0; }), blocks.end());
+		}
+
+		/// <summary>
+		/// get identity of a deleter which can be shared by elements, or 0 if deleter can not be compared.
+		/// </summary>
+		static std::uintptr_t DeleterKey(const Dt& deleter)
+		{
+			if constexpr (std::is_same<Dt, std::function<void(void*)>>::value)
+			{
+				if (auto target = deleter.template target<void(*)(void*)>())
+					return reinterpret_cast<std::uintptr_t>(*target);
+			}
+			else if constexpr (std::is_pointer<Dt>::value)
+			{
+				return reinterpret_cast<std::uintptr_t>(deleter);
+			}
+
+			return 0;
+		}
+
+		/// <summary>
+		/// find or add a deleter, and get its index.
+		/// comparable deleters are stored once and found by binary search on their sorted keys.
+		/// </summary>
+		std::uint32_t AddDeleter(const Dt& deleter)
+		{
+			std::uintptr_t key = DeleterKey(deleter);
+			auto found = deleter_keys.end();
+			if (key)
+			{
+				found = std::lower_bound(deleter_keys.begin(), deleter_keys.end(), key,
+					[](const std::pair<std::uintptr_t, std::uint32_t>& entry, std::uintptr_t value) { return entry.first < value; });
+				if (found != deleter_keys.end() && found->first == key)
+					return found->second;
+			}
+
+			auto id = static_cast<std::uint32_t>(deleters.size());
+			deleters.push_back(deleter);
+			if (key)
+				deleter_keys.emplace(found, key, id);
+
+			return id;
+		}
+
+		/// <summary>
+		/// drop deleters which no element refers.
+		/// </summary>
+		void ClearDeleters()
+		{
+			deleters.clear();
+			deleter_keys.clear();
+		}
+
+		/// <summary>
+		/// rew pointers of elements.
+		/// </summary>
+		std::vector<T*> objects;
+
+		/// <summary>
+		/// reference counters of elements.
+		/// </summary>
+		std::vector<RefCounter*> counters;
+
+		/// <summary>
+		/// index of deleter of each element.
+		/// </summary>
+		std::vector<std::uint32_t> deleter_ids;
+
+		/// <summary>
+		/// references per counter, sorted by address of counter.
+		/// </summary>
+		std::vector<Block> blocks;
+
+		/// <summary>
+		/// deleters referred by elements.
+		/// </summary>
+		std::vector<Dt> deleters;
+
+		/// <summary>
+		/// keys of comparable deleters sorted for lookup, with their indices.
+		/// </summary>
+		std::vector<std::pair<std::uintptr_t, std::uint32_t>> deleter_keys;
+
+	};
+
+
+	/// <summary>
+	/// non thread safe slab storing objects of a type and their reference counts in parallel arrays.
+	/// objects are addressed by 32 bit index, and never move while they are alive.
+	/// </summary>
+	template <class T>
+	class compact_slab
+	{
+	public:
+		template <class U> friend class compact_shared;
+
+		/// <summary>
+		/// index meaning null.
+		/// </summary>
+		static constexpr std::uint32_t null_index = std::numeric_limits<std::uint32_t>::max();
+
+		/// <summary>
+		/// number of objects in a chunk.
+		/// </summary>
+		static constexpr std::uint32_t chunk_size = 1024;
+
+		/// <summary>
+		/// get slab for the type.
+		/// </summary>
+		static compact_slab& instance()
+		{
+			static compact_slab slab;
+			return slab;
+		}
+
+		/// <summary>
+		/// copy constructor is disabled.
+		/// </summary>
+		compact_slab(const compact_slab&) = delete;
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		compact_slab& operator=(const compact_slab&) = delete;
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~compact_slab()
+		{
+			for (std::uint32_t i = 0; i < counts.size(); ++i)
+			{
+				if (counts[i])
+					Get(i)->~T();
+			}
+			for (auto chunk : chunks)
+				delete[] chunk;
+		}
+
+		/// <summary>
+		/// count alive objects.
+		/// </summary>
+		size_t size() const
+		{
+			return counts.size() - free_indices.size();
+		}
+
+		/// <summary>
+		/// count allocated slots.
+		/// </summary>
+		size_t capacity() const
+		{
+			return chunks.size() * chunk_size;
+		}
+
+	private:
+		/// <summary>
+		/// uninitialized storage for an object.
+		/// </summary>
+		struct alignas(T) Storage
+		{
+			unsigned char bytes[sizeof(T)];
+		};
+
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		compact_slab()
+		{
+		}
+
+		/// <summary>
+		/// construct an object owned by one owner.
+		/// </summary>
+		template <class... Args>
+		std::uint32_t Create(Args&&... args)
+		{
+			// slot is reserved with count 0 while constructing, so that T's constructor making another object gets another slot.
+			std::uint32_t index;
+			if (!free_indices.empty())
+			{
+				index = free_indices.back();
+				free_indices.pop_back();
+			}
+			else
+			{
+				index = static_cast<std::uint32_t>(counts.size());
+				assert(index != null_index);
+				if (index == capacity())
+					chunks.push_back(new Storage[chunk_size]);
+				counts.push_back(0);
+			}
+
+			try
+			{
+				new (Get(index)) T(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				free_indices.push_back(index);
+				throw;
+			}
+			counts[index] = 1;
+			SMART_POINTER_NTS_LOG("retain resource: " + std::to_string((unsigned long)Get(index)) + " with compact shared at " + std::to_string(index));
+
+			return index;
+		}
+
+		/// <summary>
+		/// get object at an index.
+		/// </summary>
+		T* Get(std::uint32_t index) const
+		{
+			return reinterpret_cast<T*>(chunks[index / chunk_size][index % chunk_size].bytes);
+		}
+
+		/// <summary>
+		/// increase ref count.
+		/// </summary>
+		void IncreaseOwner(std::uint32_t index)
+		{
+			++counts[index];
+		}
+
+		/// <summary>
+		/// decrease ref count, and destroy the object if no owner is left.
+		/// </summary>
+		void DecreaseOwner(std::uint32_t index)
+		{
+			if (--counts[index] == 0)
+			{
+				SMART_POINTER_NTS_LOG("release resource: " + std::to_string((unsigned long)Get(index)) + " with compact shared at " + std::to_string(index));
+				Get(index)->~T();
+				free_indices.push_back(index);
+			}
+		}
+
+		/// <summary>
+		/// count owners.
+		/// </summary>
+		long CountOwners(std::uint32_t index) const
+		{
+			return counts[index];
+		}
+
+		/// <summary>
+		/// object storages.
+		/// </summary>
+		std::vector<Storage*> chunks;
+
+		/// <summary>
+		/// reference counts parallel to object storages. 0 means free slot.
+		/// </summary>
+		std::vector<std::uint32_t> counts;
+
+		/// <summary>
+		/// free slots.
+		/// </summary>
+		std::vector<std::uint32_t> free_indices;
+
+	};
+
+
+	/// <summary>
+	/// non thread safe shared pointer class represented by 32 bit index into compact_slab.
+	/// </summary>
+	template <class T>
+	class compact_shared
+	{
+	public:
+		using Slab = compact_slab<T>;
+
+		/// <summary>
+		/// deleter of shared pointer converted from compact shared.
+		/// </summary>
+		struct Deleter
+		{
+			std::uint32_t index;
+
+			void operator()(void*) const
+			{
+				Slab::instance().DecreaseOwner(index);
+			}
+		};
+
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		compact_shared()
+			: index(Slab::null_index)
+		{
+		}
+
+		/// <summary>
+		/// copy constructor.
+		/// </summary>
+		compact_shared(const compact_shared& target)
+			: index(target.index)
+		{
+			if (index != Slab::null_index)
+				Slab::instance().IncreaseOwner(index);
+		}
+
+		/// <summary>
+		/// move constructor.
+		/// </summary>
+		compact_shared(compact_shared&& target) noexcept
+			: index(target.index)
+		{
+			target.index = Slab::null_index;
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~compact_shared()
+		{
+			Dispose();
+		}
+
+		/// <summary>
+		/// copy assignment.
+		/// </summary>
+		compact_shared& operator=(const compact_shared& target)
+		{
+			if (this->index == target.index)
+				return *this;
+
+			Dispose();
+			if ((this->index = target.index) != Slab::null_index)
+				Slab::instance().IncreaseOwner(index);
+
+			return *this;
+		}
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		compact_shared& operator=(compact_shared&& target) noexcept
+		{
+			assert(this != &target);
+
+			Dispose();
+			this->index = target.index;
+			target.index = Slab::null_index;
+
+			return *this;
+		}
+
+		/// <summary>
+		/// construct an object in slab.
+		/// </summary>
+		template <class... Args>
+		static compact_shared make(Args&&... args)
+		{
+			return compact_shared(Slab::instance().Create(std::forward<Args>(args)...));
+		}
+
+		/// <summary>
+		/// convert from shared pointer.
+		/// a pointer converted by to_shared shares its object, and a uniquely owned object is moved into slab.
+		/// moving invalidates raw pointers into the original object, and would expire its weak pointers,
+		/// so null is returned when the object is observed by weak pointers or shared by other owners.
+		/// </summary>
+		static compact_shared from_shared(shared_ptr<T>&& target)
+		{
+			if (!target)
+				return compact_shared();
+
+			if (auto deleter = target.get_deleter().template target<Deleter>())
+			{
+				Slab::instance().IncreaseOwner(deleter->index);
+				target.reset();
+				return compact_shared(deleter->index);
+			}
+
+			if (target.use_count() == 1 && AccesserForFactory::CountObservers(AccesserForFactory::GetRefCounter(target)) == 0)
+			{
+				auto result = make(std::move(*target.get()));
+				target.reset();
+				return result;
+			}
+
+			return compact_shared();
+		}
+
+		/// <summary>
+		/// convert to shared pointer sharing ownership with this.
+		/// </summary>
+		shared_ptr<T> to_shared() const
+		{
+			if (index == Slab::null_index)
+				return shared_ptr<T>();
+
+			Slab::instance().IncreaseOwner(index);
+			return shared_ptr<T>(get(), Deleter{ index });
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return index != Slab::null_index;
+		}
+
+		/// <summary>
+		/// calling members of a managing resource.
+		/// </summary>
+		T* operator->() const
+		{
+			return get();
+		}
+
+		/// <summary>
+		/// get reference of a managing resource.
+		/// </summary>
+		T& operator*() const
+		{
+			return *get();
+		}
+
+		/// <summary>
+		/// get rew pointer.
+		/// </summary>
+		T* get() const
+		{
+			T* result = nullptr;
+			if (index != Slab::null_index)
+				result = Slab::instance().Get(index);
+
+			return result;
+		}
+
+		/// <summary>
+		/// get index in slab.
+		/// </summary>
+		std::uint32_t slab_index() const
+		{
+			return index;
+		}
+
+		/// <summary>
+		/// get reference count.
+		/// </summary>
+		long use_count() const
+		{
+			long result = 0;
+			if (index != Slab::null_index)
+				result = Slab::instance().CountOwners(index);
+
+			return result;
+		}
+
+		/// <summary>
+		/// dispose current resource, and set null.
+		/// </summary>
+		void reset()
+		{
+			Dispose();
+		}
+
+	private:
+		/// <summary>
+		/// constructor from an owned index.
+		/// </summary>
+		explicit compact_shared(std::uint32_t index)
+			: index(index)
+		{
+		}
+
+		/// <summary>
+		/// dispose a managing resource if needed.
+		/// </summary>
+		void Dispose()
+		{
+			if (index != Slab::null_index)
+			{
+				Slab::instance().DecreaseOwner(index);
+				index = Slab::null_index;
+			}
+		}
+
+		/// <summary>
+		/// index in slab.
+		/// </summary>
+		std::uint32_t index;
+
+	};
+
+	/// <summary>
+	/// construct an object managed by compact shared.
+	/// </summary>
+	template <class T, class... Args>
+	compact_shared<T> make_compact_shared(Args&&... args)
+	{
+		return compact_shared<T>::make(std::forward<Args>(args)...);
+	}
+
+	/// <summary>
+	/// compare managing resources.
+	/// </summary>
+	template <class T>
+	bool operator==(const compact_shared<T>& target1, const compact_shared<T>& target2)
+	{
+		return target1.slab_index() == target2.slab_index();
+	}
+
+
+	/// <summary>
+	/// handle of an object in slot_pool, represented by slot index and generation.
+	/// </summary>
+	template <class T>
+	struct slot_handle
+	{
+		/// <summary>
+		/// index meaning null.
+		/// </summary>
+		static constexpr std::uint32_t null_index = std::numeric_limits<std::uint32_t>::max();
+
+		/// <summary>
+		/// slot index in pool.
+		/// </summary>
+		std::uint32_t index = null_index;
+
+		/// <summary>
+		/// generation of the slot when this handle was taken.
+		/// </summary>
+		std::uint32_t generation = 0;
+
+		/// <summary>
+		/// check if handle is not null. this does not mean the object is alive.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return index != null_index;
+		}
+	};
+
+	/// <summary>
+	/// compare handles.
+	/// </summary>
+	template <class T>
+	bool operator==(const slot_handle<T>& target1, const slot_handle<T>& target2)
+	{
+		return target1.index == target2.index && target1.generation == target2.generation;
+	}
+
+
+	/// <summary>
+	/// non thread safe slot map owning objects shared by shared pointers.
+	/// objects are observed by slot_handle instead of weak pointer,
+	/// so that observers neither keep counter alive nor dereference it for validation.
+	/// this pool must outlive all of shared pointers made by it.
+	/// </summary>
+	template <class T>
+	class slot_pool
+	{
+	public:
+		/// <summary>
+		/// number of objects in a chunk.
+		/// </summary>
+		static constexpr std::uint32_t chunk_size = 1024;
+
+		/// <summary>
+		/// deleter of shared pointers made by pool.
+		/// </summary>
+		struct Deleter
+		{
+			slot_pool* pool;
+			std::uint32_t index;
+
+			void operator()(void*) const
+			{
+				pool->Release(index);
+			}
+		};
+
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		slot_pool()
+		{
+		}
+
+		/// <summary>
+		/// copy constructor is disabled.
+		/// </summary>
+		slot_pool(const slot_pool&) = delete;
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		slot_pool& operator=(const slot_pool&) = delete;
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~slot_pool()
+		{
+			assert(size() == 0);
+			for (auto chunk : chunks)
+				delete[] chunk;
+		}
+
+		/// <summary>
+		/// construct an object in pool, and get its first owner.
+		/// </summary>
+		template <class... Args>
+		shared_ptr<T> make(Args&&... args)
+		{
+			// slot is reserved without counter while constructing, so that T's constructor making another object gets another slot.
+			std::uint32_t index;
+			if (!free_indices.empty())
+			{
+				index = free_indices.back();
+				free_indices.pop_back();
+			}
+			else
+			{
+				index = static_cast<std::uint32_t>(slots.size());
+				assert(index != slot_handle<T>::null_index);
+				if (index == chunks.size() * chunk_size)
+					chunks.push_back(new Storage[chunk_size]);
+				slots.push_back(Slot{ 0, nullptr });
+			}
+
+			try
+			{
+				new (Get(index)) T(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				free_indices.push_back(index);
+				throw;
+			}
+
+			shared_ptr<T> result(Get(index), Deleter{ this, index });
+			slots[index].counter = result.ref_count;
+
+			return result;
+		}
+
+		/// <summary>
+		/// get handle of an object owned by a shared pointer made by this pool.
+		/// null handle is returned for other shared pointers.
+		/// </summary>
+		slot_handle<T> handle(const shared_ptr<T>& owner) const
+		{
+			slot_handle<T> result;
+			auto deleter = owner.get_deleter().template target<Deleter>();
+			if (owner && deleter && deleter->pool == this)
+			{
+				result.index = deleter->index;
+				result.generation = slots[deleter->index].generation;
+			}
+			return result;
+		}
+
+		/// <summary>
+		/// check if an object of a handle is alive.
+		/// </summary>
+		bool valid(const slot_handle<T>& target) const
+		{
+			return target.index < slots.size()
+				&& slots[target.index].generation == target.generation
+				&& slots[target.index].counter;
+		}
+
+		/// <summary>
+		/// get rew pointer of a handle without owning it. nullptr is returned if the object is dead.
+		/// </summary>
+		T* get(const slot_handle<T>& target) const
+		{
+			T* result = nullptr;
+			if (valid(target))
+				result = Get(target.index);
+
+			return result;
+		}
+
+		/// <summary>
+		/// try locking an object of a handle.
+		/// </summary>
+		shared_ptr<T> lock(const slot_handle<T>& target)
+		{
+			if (valid(target))
+				return shared_ptr<T>(Get(target.index), slots[target.index].counter, Deleter{ this, target.index });
+			else
+				return shared_ptr<T>();
+		}
+
+		/// <summary>
+		/// count alive objects.
+		/// </summary>
+		size_t size() const
+		{
+			return slots.size() - free_indices.size();
+		}
+
+	private:
+		/// <summary>
+		/// uninitialized storage for an object.
+		/// </summary>
+		struct alignas(T) Storage
+		{
+			unsigned char bytes[sizeof(T)];
+		};
+
+		/// <summary>
+		/// state of a slot.
+		/// </summary>
+		struct Slot
+		{
+			/// <summary>
+			/// increased every time the object in slot is released.
+			/// </summary>
+			std::uint32_t generation;
+
+			/// <summary>
+			/// counter of the object. nullptr if slot is free.
+			/// </summary>
+			SharedPtrRefCounter* counter;
+		};
+
+		/// <summary>
+		/// get object at an index.
+		/// </summary>
+		T* Get(std::uint32_t index) const
+		{
+			return reinterpret_cast<T*>(chunks[index / chunk_size][index % chunk_size].bytes);
+		}
+
+		/// <summary>
+		/// destroy an object whose owners are gone, and invalidate its handles.
+		/// </summary>
+		void Release(std::uint32_t index)
+		{
+			Get(index)->~T();
+			++slots[index].generation;
+			slots[index].counter = nullptr;
+			free_indices.push_back(index);
+		}
+
+		/// <summary>
+		/// object storages.
+		/// </summary>
+		std::vector<Storage*> chunks;
+
+		/// <summary>
+		/// slot states parallel to object storages.
+		/// </summary>
+		std::vector<Slot> slots;
+
+		/// <summary>
+		/// free slots.
+		/// </summary>
+		std::vector<std::uint32_t> free_indices;
+
+	};
+
+	/// <summary>
+	/// visitor passed to trace functions of cycle collectable types.
+	/// </summary>
+	class cycle_tracer
+	{
+	public:
+		friend class cycle_collector;
+		template <class T>
+		friend void PossibleCycleRoot(SharedPtrRefCounter* ref_count, T* resource);
+
+		/// <summary>
+		/// visit a shared pointer member.
+		/// </summary>
+		template <class U, class Dt>
+		void operator()(shared_ptr<U, Dt>& edge);
+
+		/// <summary>
+		/// visit a weak pointer member. observers never make a cycle, thus nothing todo.
+		/// </summary>
+		template <class U>
+		void operator()(weak_ptr<U>&)
+		{
+		}
+
+	private:
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		cycle_tracer(cycle_collector& collector)
+			: collector(collector)
+		{
+		}
+
+		/// <summary>
+		/// call trace function of an object.
+		/// </summary>
+		template <class U>
+		static void Trace(void* object, cycle_tracer& tracer)
+		{
+			static_cast<U*>(object)->trace(tracer);
+		}
+
+		/// <summary>
+		/// collector running.
+		/// </summary>
+		cycle_collector& collector;
+
+	};
+
+
+	/// <summary>
+	/// non thread safe collector of garbage cycles made by shared pointers, based on trial deletion.
+	/// when an owner of a collectable object is released and owner(s) remain,
+	/// the object is buffered as possible root, and it is examined on collect().
+	/// </summary>
+	class cycle_collector
+	{
+	public:
+		friend class cycle_tracer;
+		template <class T>
+		friend void PossibleCycleRoot(SharedPtrRefCounter* ref_count, T* resource);
+
+		/// <summary>
+		/// get collector for current thread.
+		/// </summary>
+		static cycle_collector& instance()
+		{
+			thread_local cycle_collector collector;
+			return collector;
+		}
+
+		/// <summary>
+		/// copy constructor is disabled.
+		/// </summary>
+		cycle_collector(const cycle_collector&) = delete;
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		cycle_collector& operator=(const cycle_collector&) = delete;
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~cycle_collector()
+		{
+			for (auto& root : roots)
+				Unpin(root.first);
+		}
+
+		/// <summary>
+		/// examine all of possible roots, and dispose garbage cycles.
+		/// returns number of disposed objects.
+		/// </summary>
+		size_t collect()
+		{
+			return collect(std::chrono::nanoseconds::max());
+		}
+
+		/// <summary>
+		/// examine possible roots until time budget runs out, and dispose garbage cycles.
+		/// at least one root is examined. remaining roots are kept for next collection.
+		/// returns number of disposed objects.
+		/// </summary>
+		size_t collect(std::chrono::nanoseconds budget)
+		{
+			size_t result = 0;
+			auto start = std::chrono::steady_clock::now();
+			while (!roots.empty())
+			{
+				auto root = *roots.begin();
+				roots.erase(roots.begin());
+
+				if (root.first->CountOwners())
+					result += CollectFrom(root.first, root.second);
+				Unpin(root.first);
+
+				if (std::chrono::steady_clock::now() - start >= budget)
+					break;
+			}
+			return result;
+		}
+
+		/// <summary>
+		/// count buffered possible roots.
+		/// </summary>
+		size_t candidates() const
+		{
+			return roots.size();
+		}
+
+	private:
+		using TraceFunction = void (*)(void*, cycle_tracer&);
+
+		/// <summary>
+		/// what to do for visited edges.
+		/// </summary>
+		enum class Phase
+		{
+			MarkGray,
+			ScanBlack,
+			Clear,
+		};
+
+		/// <summary>
+		/// possible root.
+		/// </summary>
+		struct Root
+		{
+			void* object;
+			TraceFunction trace;
+		};
+
+		/// <summary>
+		/// object visited by trial deletion.
+		/// gray: reachable from a root. black: reachable from outside.
+		/// </summary>
+		struct Node
+		{
+			void* object;
+			TraceFunction trace;
+			long trial_count;
+			bool gray;
+			bool black;
+			std::function<void(void*)> deleter;
+		};
+
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		cycle_collector()
+			: phase(Phase::MarkGray)
+			, collecting(false)
+		{
+		}
+
+		/// <summary>
+		/// buffer a possible root. its counter is kept by an observer until it is examined.
+		/// </summary>
+		void PossibleRoot(SharedPtrRefCounter* ref_count, void* object, TraceFunction trace)
+		{
+			if (collecting || ref_count->IsImmortal())
+				return;
+
+			if (roots.emplace(ref_count, Root{ object, trace }).second)
+				ref_count->IncreaseObserver();
+		}
+
+		/// <summary>
+		/// release an observer kept by collector.
+		/// </summary>
+		static void Unpin(SharedPtrRefCounter* ref_count)
+		{
+			if (ref_count->DecreaseObserver() == 0 && ref_count->CountOwners() == 0)
+				SharedPtrRefCounter::Destroy(ref_count);
+		}
+
+		/// <summary>
+		/// trial deletion from a root, and dispose found garbage.
+		/// </summary>
+		size_t CollectFrom(SharedPtrRefCounter* root, const Root& info)
+		{
+			nodes.clear();
+
+			// subtract references made inside of subgraph.
+			phase = Phase::MarkGray;
+			nodes.emplace(root, Node{ info.object, info.trace, root->CountOwners(), true, false, nullptr });
+			Traverse(root);
+
+			// restore objects referenced from outside, and objects reachable from them.
+			phase = Phase::ScanBlack;
+			for (auto& node : nodes)
+			{
+				if (node.second.trial_count > 0 && !node.second.black)
+				{
+					node.second.black = true;
+					Traverse(node.first);
+				}
+			}
+
+			// examined possible roots are not buffered anymore.
+			std::vector<SharedPtrRefCounter*> examined;
+			std::vector<SharedPtrRefCounter*> garbage;
+			for (auto& node : nodes)
+			{
+				if (node.first != root && roots.erase(node.first))
+					examined.push_back(node.first);
+				if (!node.second.black)
+					garbage.push_back(node.first);
+			}
+
+			Dispose(garbage);
+
+			for (auto ref_count : examined)
+				Unpin(ref_count);
+
+			return garbage.size();
+		}
+
+		/// <summary>
+		/// visit objects reachable from a node.
+		/// </summary>
+		void Traverse(SharedPtrRefCounter* start)
+		{
+			cycle_tracer tracer(*this);
+			stack.push_back(start);
+			while (!stack.empty())
+			{
+				auto& node = nodes.find(stack.back())->second;
+				stack.pop_back();
+				node.trace(node.object, tracer);
+			}
+		}
+
+		/// <summary>
+		/// dispose garbage objects, whose owners are all inside of garbage.
+		/// </summary>
+		void Dispose(std::vector<SharedPtrRefCounter*>& garbage)
+		{
+			// keep garbage alive while references among them are cleared.
+			for (auto ref_count : garbage)
+				ref_count->IncreaseOwner();
+
+			collecting = true;
+			phase = Phase::Clear;
+			cycle_tracer tracer(*this);
+			for (auto ref_count : garbage)
+			{
+				auto& node = nodes.find(ref_count)->second;
+				node.trace(node.object, tracer);
+			}
+			collecting = false;
+
+			for (auto ref_count : garbage)
+			{
+				auto& node = nodes.find(ref_count)->second;
+				if (ref_count->DecreaseOwner() == 0)
+				{
+					ref_count->DisposeResource([&node]()
+					{
+						if (node.deleter)
+						{
+							node.deleter(node.object);
+							SMART_POINTER_NTS_LOG("release resource: " + std::to_string((unsigned long)node.object) + " by cycle collector");
+						}
+					});
+				}
+			}
+			nodes.clear();
+		}
+
+		/// <summary>
+		/// visit an edge.
+		/// returns true if the edge must be cleared.
+		/// </summary>
+		bool Visit(SharedPtrRefCounter* ref_count, void* object, TraceFunction trace, const std::function<void(void*)>& deleter)
+		{
+			switch (phase)
+			{
+			case Phase::MarkGray:
+			{
+				auto found = nodes.find(ref_count);
+				if (found == nodes.end())
+					found = nodes.emplace(ref_count, Node{ object, trace, ref_count->CountOwners(), false, false, deleter }).first;
+				else if (!found->second.deleter)
+					found->second.deleter = deleter;
+
+				--found->second.trial_count;
+				if (!found->second.gray)
+				{
+					found->second.gray = true;
+					stack.push_back(ref_count);
+				}
+				break;
+			}
+			case Phase::ScanBlack:
+			{
+				auto& node = nodes.find(ref_count)->second;
+				if (!node.black)
+				{
+					node.black = true;
+					stack.push_back(ref_count);
+				}
+				break;
+			}
+			case Phase::Clear:
+			{
+				auto found = nodes.find(ref_count);
+				return found != nodes.end() && !found->second.black;
+			}
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// possible roots.
+		/// </summary>
+		std::unordered_map<SharedPtrRefCounter*, Root> roots;
+
+		/// <summary>
+		/// objects visited by current trial deletion.
+		/// </summary>
+		std::unordered_map<SharedPtrRefCounter*, Node> nodes;
+
+		/// <summary>
+		/// objects to be traced.
+		/// </summary>
+		std::vector<SharedPtrRefCounter*> stack;
+
+		/// <summary>
+		/// current phase of trial deletion.
+		/// </summary>
+		Phase phase;
+
+		/// <summary>
+		/// true while collector clears references among garbage.
+		/// </summary>
+		bool collecting;
+
+	};
+
+	/// <summary>
+	/// visit a shared pointer member.
+	/// </summary>
+	template <class U, class Dt>
+	void cycle_tracer::operator()(shared_ptr<U, Dt>& edge)
+	{
+		if constexpr (is_cycle_collectable<U>::value)
+		{
+			if (edge.ref_count && collector.Visit(edge.ref_count, edge.get(), &Trace<U>, edge.get_deleter()))
+				edge.reset();
+		}
+	}
+
+	/// <summary>
+	/// buffer a possible root of garbage cycle.
+	/// </summary>
+	template <class T>
+	void PossibleCycleRoot(SharedPtrRefCounter* ref_count, T* resource)
+	{
+		cycle_collector::instance().PossibleRoot(ref_count, resource, &cycle_tracer::Trace<T>);
+	}
+
+	/// <summary>
+	/// dispose garbage cycles of current thread.
+	/// </summary>
+	inline size_t collect_cycles()
+	{
+		return cycle_collector::instance().collect();
+	}
+
+	/// <summary>
+	/// dispose garbage cycles of current thread within time budget.
+	/// </summary>
+	inline size_t collect_cycles(std::chrono::nanoseconds budget)
+	{
+		return cycle_collector::instance().collect(budget);
+	}
+
+	/// <summary>
+	/// how object_pool recycles a released object.
+	/// </summary>
+	enum class pool_recycle
+	{
+		/// <summary>
+		/// destroy released object and keep its storage. acquisition constructs a new object in it.
+		/// </summary>
+		destroy,
+
+		/// <summary>
+		/// keep released object constructed after calling reset function. acquisition reuses it.
+		/// </summary>
+		reset,
+	};
+
+	/// <summary>
+	/// statistics of object_pool.
+	/// </summary>
+	struct pool_statistics
+	{
+		/// <summary>
+		/// acquisitions served from free list.
+		/// </summary>
+		size_t hits = 0;
+
+		/// <summary>
+		/// acquisitions which allocated new storage.
+		/// </summary>
+		size_t misses = 0;
+
+		/// <summary>
+		/// released objects kept in free list.
+		/// </summary>
+		size_t recycled = 0;
+
+		/// <summary>
+		/// released objects deallocated because free list was full.
+		/// </summary>
+		size_t discarded = 0;
+	};
+
+
+	/// <summary>
+	/// non thread safe bounded pool recycling objects released by smart pointers made by make_pooled.
+	/// an object is placed in one block together with its counter, and the block is recycled as a whole,
+	/// so that acquiring and releasing a recycled object never allocate.
+	/// an object still observed by weak pointers on release is not recycled, because its counter outlives it.
+	/// this pool must outlive all of smart pointers made by it.
+	/// </summary>
+	template <class T>
+	class object_pool
+	{
+	public:
+		template <class U, class... Args>
+		friend shared_ptr<U> make_pooled(object_pool<U>& pool, Args&&... args);
+		template <class U, class... Args>
+		friend unique_ptr<U> make_pooled_unique(object_pool<U>& pool, Args&&... args);
+
+		/// <summary>
+		/// deleter of smart pointers made by pool.
+		/// </summary>
+		struct Deleter
+		{
+			object_pool* pool;
+			SharedPtrRefCounter* ref_count;
+
+			void operator()(void* obj) const
+			{
+				pool->Recycle(Block{ ref_count, static_cast<T*>(obj) });
+			}
+		};
+
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		object_pool(size_t capacity = 1024, pool_recycle mode = pool_recycle::destroy, std::function<void(T&)> resetter = nullptr)
+			: capacity(capacity)
+			, mode(mode)
+			, resetter(resetter)
+		{
+			free_list.reserve(capacity);
+		}
+
+		/// <summary>
+		/// copy constructor is disabled.
+		/// </summary>
+		object_pool(const object_pool&) = delete;
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		object_pool& operator=(const object_pool&) = delete;
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~object_pool()
+		{
+			for (auto& block : free_list)
+			{
+				if (mode == pool_recycle::reset)
+					block.obj->~T();
+				SharedPtrRefCounter::Destroy(block.ref_count);
+			}
+		}
+
+		/// <summary>
+		/// get pool of current thread for the type.
+		/// </summary>
+		static object_pool& local()
+		{
+			thread_local object_pool pool;
+			return pool;
+		}
+
+		/// <summary>
+		/// get statistics.
+		/// </summary>
+		const pool_statistics& statistics() const
+		{
+			return stats;
+		}
+
+		/// <summary>
+		/// count objects in free list.
+		/// </summary>
+		size_t size() const
+		{
+			return free_list.size();
+		}
+
+	private:
+		/// <summary>
+		/// block of a counter followed by storage of an object.
+		/// counter of a block in free list has no owner and one observer, which is this pool.
+		/// counter of a block held by unique pointer has neither owner nor observer.
+		/// </summary>
+		struct Block
+		{
+			SharedPtrRefCounter* ref_count;
+			T* obj;
+		};
+
+		/// <summary>
+		/// acquire a block in the state of free list. a recycled one is used if exists.
+		/// </summary>
+		template <class... Args>
+		Block Acquire(Args&&... args)
+		{
+			if (free_list.empty())
+			{
+				++stats.misses;
+				void* storage;
+				auto ref_count = AccesserForFactory::CreateWithStorage<counter_policy<>>(sizeof(T), alignof(T), storage);
+				try
+				{
+					T* obj = new (storage) T(std::forward<Args>(args)...);
+					ref_count->DecreaseOwner();
+					ref_count->IncreaseObserver();
+					return Block{ ref_count, obj };
+				}
+				catch (...)
+				{
+					SharedPtrRefCounter::Destroy(ref_count);
+					throw;
+				}
+			}
+
+			++stats.hits;
+			Block block = free_list.back();
+			if (mode == pool_recycle::destroy)
+				new (block.obj) T(std::forward<Args>(args)...);
+			else if constexpr (sizeof...(Args) > 0)
+				*block.obj = T(std::forward<Args>(args)...);
+			free_list.pop_back();
+
+			return block;
+		}
+
+		/// <summary>
+		/// make a block in free list owned by a shared pointer.
+		/// </summary>
+		static void Share(const Block& block)
+		{
+			block.ref_count->IncreaseOwner();
+			block.ref_count->DecreaseObserver();
+		}
+
+		/// <summary>
+		/// make a block in free list held by a unique pointer.
+		/// </summary>
+		static void Hold(const Block& block)
+		{
+			block.ref_count->DecreaseObserver();
+		}
+
+		/// <summary>
+		/// return a released block to free list, or destroy its object if it can not be recycled.
+		/// a block released by shared pointer is called while its counter is disposing resource,
+		/// which keeps one observer until this returns, and deletes the block if it has no observer after that.
+		/// </summary>
+		void Recycle(Block block)
+		{
+			long observers = block.ref_count->CountObservers();
+			if (observers <= 1 && free_list.size() < capacity)
+			{
+				++stats.recycled;
+				if (mode == pool_recycle::destroy)
+					block.obj->~T();
+				else if (resetter)
+					resetter(*block.obj);
+
+				// the observer of pool keeps the block after releasing.
+				block.ref_count->IncreaseObserver();
+				free_list.push_back(block);
+			}
+			else
+			{
+				++stats.discarded;
+				block.obj->~T();
+
+				// a block released by unique pointer has no one to delete it.
+				if (observers == 0)
+					SharedPtrRefCounter::Destroy(block.ref_count);
+			}
+		}
+
+		/// <summary>
+		/// max number of objects in free list.
+		/// </summary>
+		size_t capacity;
+
+		/// <summary>
+		/// how released objects are recycled.
+		/// </summary>
+		pool_recycle mode;
+
+		/// <summary>
+		/// function resetting released objects on pool_recycle::reset.
+		/// </summary>
+		std::function<void(T&)> resetter;
+
+		/// <summary>
+		/// released blocks.
+		/// </summary>
+		std::vector<Block> free_list;
+
+		/// <summary>
+		/// statistics.
+		/// </summary>
+		pool_statistics stats;
+
+	};
+
+	/// <summary>
+	/// make shared pointer of an object acquired from pool. the object returns to pool on last release.
+	/// </summary>
+	template <class T, class... Args>
+	shared_ptr<T> make_pooled(object_pool<T>& pool, Args&&... args)
+	{
+		auto block = pool.Acquire(std::forward<Args>(args)...);
+		object_pool<T>::Share(block);
+		return AccesserForFactory::Adopt<T, std::function<void(void*)>, counter_policy<>>(block.obj, block.ref_count, typename object_pool<T>::Deleter{ &pool, block.ref_count });
+	}
+
+	/// <summary>
+	/// make unique pointer of an object acquired from pool. the object returns to pool on release.
+	/// </summary>
+	template <class T, class... Args>
+	unique_ptr<T> make_pooled_unique(object_pool<T>& pool, Args&&... args)
+	{
+		auto block = pool.Acquire(std::forward<Args>(args)...);
+		object_pool<T>::Hold(block);
+		return unique_ptr<T>(block.obj, typename object_pool<T>::Deleter{ &pool, block.ref_count });
+	}
+
+	/// <summary>
+	/// non thread safe copy-on-write value wrapper.
+	/// copies share a value, and it is cloned only when mutable access is required while shared.
+	/// </summary>
+	template <class T>
+	class cow_ptr
+	{
+	public:
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		cow_ptr()
+		{
+		}
+
+		/// <summary>
+		/// constructor with shared value.
+		/// </summary>
+		explicit cow_ptr(shared_ptr<T> ptr)
+			: ptr(std::move(ptr))
+		{
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return (bool)ptr;
+		}
+
+		/// <summary>
+		/// calling const members of a value. this never clones.
+		/// </summary>
+		const T* operator->() const
+		{
+			return ptr.get();
+		}
+
+		/// <summary>
+		/// get const reference of a value. this never clones.
+		/// </summary>
+		const T& operator*() const
+		{
+			return *ptr.get();
+		}
+
+		/// <summary>
+		/// get const rew pointer. this never clones.
+		/// </summary>
+		const T* get() const
+		{
+			return ptr.get();
+		}
+
+		/// <summary>
+		/// get mutable reference of a value. the value is cloned if it is shared.
+		/// </summary>
+		T& write()
+		{
+			unshare();
+			return *ptr.get();
+		}
+
+		/// <summary>
+		/// clone a value if it is shared.
+		/// </summary>
+		void unshare()
+		{
+			if (ptr.use_count() > 1)
+				ptr = make_shared<T>(*ptr.get());
+		}
+
+		/// <summary>
+		/// check if a value is not shared.
+		/// </summary>
+		bool unique() const
+		{
+			return ptr.use_count() == 1;
+		}
+
+		/// <summary>
+		/// get reference count.
+		/// </summary>
+		long use_count() const
+		{
+			return ptr.use_count();
+		}
+
+		/// <summary>
+		/// dispose current value, and set null.
+		/// </summary>
+		void reset()
+		{
+			ptr.reset();
+		}
+
+	private:
+		/// <summary>
+		/// shared value.
+		/// </summary>
+		shared_ptr<T> ptr;
+
+	};
+
+	/// <summary>
+	/// make copy-on-write wrapper of a new value.
+	/// </summary>
+	template <class T, class... Args>
+	cow_ptr<T> make_cow(Args&&... args)
+	{
+		return cow_ptr<T>(make_shared<T>(std::forward<Args>(args)...));
+	}
+
+	/// <summary>
+	/// non thread safe persistent vector, implemented as radix balanced trie with tail.
+	/// copies share all nodes, and an update copies only shared nodes on its path.
+	/// nodes which are not shared (use_count() == 1) are updated in place.
+	/// </summary>
+	template <class T>
+	class persistent_vector
+	{
+	public:
+		/// <summary>
+		/// constructor with empty.
+		/// </summary>
+		persistent_vector()
+			: root(make_shared<Node>())
+			, tail(make_shared<Node>())
+			, count(0)
+			, shift(bits)
+		{
+		}
+
+		/// <summary>
+		/// count elements.
+		/// </summary>
+		size_t size() const
+		{
+			return count;
+		}
+
+		/// <summary>
+		/// check if there is no element.
+		/// </summary>
+		bool empty() const
+		{
+			return count == 0;
+		}
+
+		/// <summary>
+		/// get an element.
+		/// </summary>
+		const T& operator[](size_t index) const
+		{
+			assert(index < count);
+			return LeafFor(index).get()->values[index & mask];
+		}
+
+		/// <summary>
+		/// replace an element.
+		/// </summary>
+		void set(size_t index, T value)
+		{
+			assert(index < count);
+			if (index >= TailOffset())
+			{
+				Writable(tail)->values[index & mask] = std::move(value);
+				return;
+			}
+
+			auto slot = &root;
+			for (size_t level = shift; level > 0; level -= bits)
+				slot = &Writable(*slot)->children[(index >> level) & mask];
+			Writable(*slot)->values[index & mask] = std::move(value);
+		}
+
+		/// <summary>
+		/// add an element at the end.
+		/// </summary>
+		void push_back(T value)
+		{
+			if (count - TailOffset() < width)
+			{
+				Writable(tail)->values.push_back(std::move(value));
+				++count;
+				return;
+			}
+
+			// tail is full, thus it is pushed into trie.
+			if ((count >> bits) > (size_t(1) << shift))
+			{
+				auto new_root = make_shared<Node>();
+				new_root->children.push_back(std::move(root));
+				new_root->children.push_back(NewPath(shift, std::move(tail)));
+				root = std::move(new_root);
+				shift += bits;
+			}
+			else
+			{
+				PushTail(shift, root, std::move(tail));
+			}
+
+			tail = make_shared<Node>();
+			tail->values.reserve(width);
+			tail->values.push_back(std::move(value));
+			++count;
+		}
+
+		/// <summary>
+		/// remove the last element.
+		/// </summary>
+		void pop_back()
+		{
+			assert(count > 0);
+			if (count - TailOffset() > 1)
+			{
+				Writable(tail)->values.pop_back();
+				--count;
+				return;
+			}
+			if (count == 1)
+			{
+				*this = persistent_vector();
+				return;
+			}
+
+			// tail becomes empty, thus the last leaf in trie becomes tail.
+			auto new_tail = LeafFor(count - 2);
+			if (PopTail(shift, root))
+				root = make_shared<Node>();
+			if (shift > bits && root->children.size() == 1)
+			{
+				auto child = root->children[0];
+				root = std::move(child);
+				shift -= bits;
+			}
+			tail = std::move(new_tail);
+			--count;
+		}
+
+	private:
+		/// <summary>
+		/// bits of index consumed by a level.
+		/// </summary>
+		static constexpr size_t bits = 5;
+		static constexpr size_t width = size_t(1) << bits;
+		static constexpr size_t mask = width - 1;
+
+		/// <summary>
+		/// node of trie. internal node has children, and leaf has values.
+		/// </summary>
+		struct Node
+		{
+			std::vector<shared_ptr<Node>> children;
+			std::vector<T> values;
+		};
+
+		/// <summary>
+		/// get a node which can be updated in place, by copying it if it is shared.
+		/// nodes must be made writable from root, because a node under shared one is shared as well.
+		/// </summary>
+		static Node* Writable(shared_ptr<Node>& node)
+		{
+			if (node.use_count() != 1)
+				node = make_shared<Node>(*node.get());
+
+			return node.get();
+		}
+
+		/// <summary>
+		/// index of the first element in tail.
+		/// </summary>
+		size_t TailOffset() const
+		{
+			return count < width ? 0 : ((count - 1) >> bits) << bits;
+		}
+
+		/// <summary>
+		/// get leaf having an element.
+		/// </summary>
+		const shared_ptr<Node>& LeafFor(size_t index) const
+		{
+			if (index >= TailOffset())
+				return tail;
+
+			auto node = &root;
+			for (size_t level = shift; level > 0; level -= bits)
+				node = &node->get()->children[(index >> level) & mask];
+			return *node;
+		}
+
+		/// <summary>
+		/// make path of single child nodes to a leaf.
+		/// </summary>
+		static shared_ptr<Node> NewPath(size_t level, shared_ptr<Node> leaf)
+		{
+			if (level == 0)
+				return leaf;
+
+			auto node = make_shared<Node>();
+			node->children.push_back(NewPath(level - bits, std::move(leaf)));
+			return node;
+		}
+
+		/// <summary>
+		/// push full tail into trie.
+		/// </summary>
+		void PushTail(size_t level, shared_ptr<Node>& slot, shared_ptr<Node> leaf)
+		{
+			Node* node = Writable(slot);
+			size_t index = ((count - 1) >> level) & mask;
+			if (level == bits)
+				node->children.push_back(std::move(leaf));
+			else if (index < node->children.size())
+				PushTail(level - bits, node->children[index], std::move(leaf));
+			else
+				node->children.push_back(NewPath(level - bits, std::move(leaf)));
+		}
+
+		/// <summary>
+		/// remove the last leaf from trie.
+		/// returns true if the node becomes empty.
+		/// </summary>
+		bool PopTail(size_t level, shared_ptr<Node>& slot)
+		{
+			// the node has the last leaf only.
+			if ((((count - 2) >> bits) & ((size_t(1) << level) - 1)) == 0)
+				return true;
+
+			Node* node = Writable(slot);
+			size_t index = ((count - 2) >> level) & mask;
+			if (level == bits || PopTail(level - bits, node->children[index]))
+				node->children.pop_back();
+
+			return false;
+		}
+
+		/// <summary>
+		/// root of trie.
+		/// </summary>
+		shared_ptr<Node> root;
+
+		/// <summary>
+		/// the last leaf, which is not in trie.
+		/// </summary>
+		shared_ptr<Node> tail;
+
+		/// <summary>
+		/// number of elements.
+		/// </summary>
+		size_t count;
+
+		/// <summary>
+		/// bits shifted at root.
+		/// </summary>
+		size_t shift;
+
+	};
+
+
+	/// <summary>
+	/// non thread safe persistent hash map, implemented as hash array mapped trie.
+	/// copies share all nodes, and an update copies only shared nodes on its path.
+	/// nodes which are not shared (use_count() == 1) are updated in place.
+	/// </summary>
+	template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+	class persistent_map
+	{
+	public:
+		/// <summary>
+		/// constructor with empty.
+		/// </summary>
+		persistent_map()
+			: root(make_shared<Node>())
+			, count(0)
+		{
+		}
+
+		/// <summary>
+		/// count elements.
+		/// </summary>
+		size_t size() const
+		{
+			return count;
+		}
+
+		/// <summary>
+		/// check if there is no element.
+		/// </summary>
+		bool empty() const
+		{
+			return count == 0;
+		}
+
+		/// <summary>
+		/// find a value. nullptr is returned if the key is not found.
+		/// </summary>
+		const V* find(const K& key) const
+		{
+			size_t hash = Hash()(key);
+			const Node* node = root.get();
+			for (size_t shift = 0; shift < hash_bits; shift += bits)
+			{
+				auto bit = Bit(hash, shift);
+				if (node->datamap & bit)
+				{
+					auto& entry = node->values[Index(node->datamap, bit)];
+					return KeyEqual()(entry.first, key) ? &entry.second : nullptr;
+				}
+				if (!(node->nodemap & bit))
+					return nullptr;
+
+				node = node->children[Index(node->nodemap, bit)].get();
+			}
+
+			// collision node.
+			for (auto& entry : node->values)
+			{
+				if (KeyEqual()(entry.first, key))
+					return &entry.second;
+			}
+			return nullptr;
+		}
+
+		/// <summary>
+		/// check if the key exists.
+		/// </summary>
+		bool contains(const K& key) const
+		{
+			return find(key) != nullptr;
+		}
+
+		/// <summary>
+		/// insert a value, or replace a value of existing key.
+		/// </summary>
+		void set(K key, V value)
+		{
+			size_t hash = Hash()(key);
+			if (Insert(root, hash, 0, std::move(key), std::move(value)))
+				++count;
+		}
+
+		/// <summary>
+		/// remove a value. returns true if the key is removed.
+		/// </summary>
+		bool erase(const K& key)
+		{
+			if (!contains(key))
+				return false;
+
+			Remove(root, Hash()(key), 0, key);
+			--count;
+			return true;
+		}
+
+		/// <summary>
+		/// call a function for each key and value.
+		/// </summary>
+		template <class Fn>
+		void for_each(Fn&& fn) const
+		{
+			ForEach(*root.get(), fn);
+		}
+
+	private:
+		/// <summary>
+		/// bits of hash consumed by a level.
+		/// </summary>
+		static constexpr size_t bits = 5;
+		static constexpr size_t mask = (size_t(1) << bits) - 1;
+		static constexpr size_t hash_bits = sizeof(size_t) * 8;
+
+		/// <summary>
+		/// node of trie. values and children are ordered by bit position of each map.
+		/// a node below all hash bits is collision node, which has values only.
+		/// </summary>
+		struct Node
+		{
+			std::uint32_t datamap = 0;
+			std::uint32_t nodemap = 0;
+			std::vector<std::pair<K, V>> values;
+			std::vector<shared_ptr<Node>> children;
+		};
+
+		/// <summary>
+		/// get a node which can be updated in place, by copying it if it is shared.
+		/// nodes must be made writable from root, because a node under shared one is shared as well.
+		/// </summary>
+		static Node* Writable(shared_ptr<Node>& node)
+		{
+			if (node.use_count() != 1)
+				node = make_shared<Node>(*node.get());
+
+			return node.get();
+		}
+
+		/// <summary>
+		/// get bit for hash at a level.
+		/// </summary>
+		static std::uint32_t Bit(size_t hash, size_t shift)
+		{
+			return std::uint32_t(1) << ((hash >> shift) & mask);
+		}
+
+		/// <summary>
+		/// get index in values or children from bitmap.
+		/// </summary>
+		static size_t Index(std::uint32_t map, std::uint32_t bit)
+		{
+			std::uint32_t x = map & (bit - 1);
+			x = x - ((x >> 1) & 0x55555555u);
+			x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+			return (((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+		}
+
+		/// <summary>
+		/// insert a value under a node. returns true if the key is new.
+		/// </summary>
+		static bool Insert(shared_ptr<Node>& slot, size_t hash, size_t shift, K&& key, V&& value)
+		{
+			Node* node = Writable(slot);
+			if (shift >= hash_bits)
+			{
+				for (auto& entry : node->values)
+				{
+					if (KeyEqual()(entry.first, key))
+					{
+						entry.second = std::move(value);
+						return false;
+					}
+				}
+				node->values.emplace_back(std::move(key), std::move(value));
+				return true;
+			}
+
+			auto bit = Bit(hash, shift);
+			if (node->datamap & bit)
+			{
+				auto index = Index(node->datamap, bit);
+				auto& entry = node->values[index];
+				if (KeyEqual()(entry.first, key))
+				{
+					entry.second = std::move(value);
+					return false;
+				}
+
+				// two keys share the position, thus they are moved into a new child.
+				auto child = make_shared<Node>();
+				auto existing_hash = Hash()(entry.first);
+				Insert(child, existing_hash, shift + bits, std::move(entry.first), std::move(entry.second));
+				Insert(child, hash, shift + bits, std::move(key), std::move(value));
+
+				node->values.erase(node->values.begin() + index);
+				node->datamap &= ~bit;
+				node->nodemap |= bit;
+				node->children.insert(node->children.begin() + Index(node->nodemap, bit), std::move(child));
+				return true;
+			}
+			if (node->nodemap & bit)
+				return Insert(node->children[Index(node->nodemap, bit)], hash, shift + bits, std::move(key), std::move(value));
+
+			node->datamap |= bit;
+			node->values.insert(node->values.begin() + Index(node->datamap, bit), std::make_pair(std::move(key), std::move(value)));
+			return true;
+		}
+
+		/// <summary>
+		/// remove an existing value under a node.
+		/// </summary>
+		static void Remove(shared_ptr<Node>& slot, size_t hash, size_t shift, const K& key)
+		{
+			Node* node = Writable(slot);
+			if (shift >= hash_bits)
+			{
+				for (auto entry = node->values.begin(); entry != node->values.end(); ++entry)
+				{
+					if (KeyEqual()(entry->first, key))
+					{
+						node->values.erase(entry);
+						return;
+					}
+				}
+				return;
+			}
+
+			auto bit = Bit(hash, shift);
+			if (node->datamap & bit)
+			{
+				node->values.erase(node->values.begin() + Index(node->datamap, bit));
+				node->datamap &= ~bit;
+				return;
+			}
+
+			auto index = Index(node->nodemap, bit);
+			Remove(node->children[index], hash, shift + bits, key);
+
+			// a child having a single value is inlined into this node.
+			Node* child = node->children[index].get();
+			if (child->children.empty() && child->values.size() <= 1)
+			{
+				if (child->values.size() == 1)
+				{
+					auto entry = std::move(child->values.front());
+					node->datamap |= bit;
+					node->values.insert(node->values.begin() + Index(node->datamap, bit), std::move(entry));
+				}
+				node->nodemap &= ~bit;
+				node->children.erase(node->children.begin() + index);
+			}
+		}
+
+		/// <summary>
+		/// call a function for each key and value under a node.
+		/// </summary>
+		template <class Fn>
+		static void ForEach(const Node& node, Fn& fn)
+		{
+			for (auto& entry : node.values)
+				fn(entry.first, entry.second);
+			for (auto& child : node.children)
+				ForEach(*child.get(), fn);
+		}
+
+		/// <summary>
+		/// root of trie.
+		/// </summary>
+		shared_ptr<Node> root;
+
+		/// <summary>
+		/// number of elements.
+		/// </summary>
+		size_t count;
+
+	};
+
+	/// <summary>
+	/// non thread safe group of objects which live and die together.
+	/// objects are allocated in an arena, and all of them are owned by one counter.
+	/// shared pointers to members and the group itself are owners of the group.
+	/// </summary>
+	class shared_group
+	{
+	public:
+		/// <summary>
+		/// constructor.
+		/// </summary>
+		explicit shared_group(size_t chunk_size = 4096)
+			: state(MakeState(chunk_size))
+		{
+		}
+
+		/// <summary>
+		/// construct an object in group, and get shared pointer owning the group.
+		/// </summary>
+		template <class T, class... Args>
+		shared_ptr<T> make(Args&&... args)
+		{
+			State* group = state.get();
+			if constexpr (!std::is_trivially_destructible<T>::value)
+			{
+				if (group->destructors.size() == group->destructors.capacity())
+					group->destructors.reserve(group->destructors.size() * 2 + 16);
+			}
+
+			T* obj = new (group->Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			if constexpr (!std::is_trivially_destructible<T>::value)
+				group->destructors.push_back(Destructor{ obj, &AccesserForFactory::DestroyInPlace<T> });
+			++group->objects;
+
+			return AccesserForFactory::Share<T, std::function<void(void*)>, counter_policy<>>(
+				obj, AccesserForFactory::GetRefCounter(state), Deleter{ group });
+		}
+
+		/// <summary>
+		/// count objects in group.
+		/// </summary>
+		size_t size() const
+		{
+			return state.get() ? state.get()->objects : 0;
+		}
+
+		/// <summary>
+		/// get reference count of group.
+		/// </summary>
+		long use_count() const
+		{
+			return state.get() ? state.use_count() : 0;
+		}
+
+	private:
+		/// <summary>
+		/// destructor of an object in group.
+		/// </summary>
+		struct Destructor
+		{
+			void* obj;
+			void (*destroy)(void*);
+		};
+
+		/// <summary>
+		/// state of group, placed together with its counter.
+		/// </summary>
+		struct State
+		{
+			State(size_t chunk_size)
+				: chunk_size(chunk_size)
+				, cursor(nullptr)
+				, limit(nullptr)
+				, objects(0)
+			{
+			}
+
+			~State()
+			{
+				for (auto destructor = destructors.rbegin(); destructor != destructors.rend(); ++destructor)
+					destructor->destroy(destructor->obj);
+				for (auto chunk : chunks)
+					::operator delete(chunk);
+
+				SMART_POINTER_NTS_LOG("release group: " + std::to_string(objects) + " objects in " + std::to_string(chunks.size()) + " chunks");
+			}
+
+			/// <summary>
+			/// allocate storage in arena.
+			/// </summary>
+			void* Allocate(size_t size, size_t alignment)
+			{
+				void* result = cursor;
+				size_t space = limit - cursor;
+				if (!cursor || !std::align(alignment, size, result, space))
+				{
+					size_t bytes = size + alignment > chunk_size ? size + alignment : chunk_size;
+					chunks.push_back(nullptr);
+					chunks.back() = static_cast<char*>(::operator new(bytes));
+
+					result = cursor = chunks.back();
+					space = bytes;
+					limit = cursor + bytes;
+					std::align(alignment, size, result, space);
+				}
+				cursor = static_cast<char*>(result) + size;
+
+				return result;
+			}
+
+			size_t chunk_size;
+			std::vector<char*> chunks;
+			char* cursor;
+			char* limit;
+			std::vector<Destructor> destructors;
+			size_t objects;
+		};
+
+		/// <summary>
+		/// deleter of group, called with any member when the last owner is released.
+		/// </summary>
+		struct Deleter
+		{
+			State* group;
+
+			void operator()(void*) const
+			{
+				group->~State();
+			}
+		};
+
+		/// <summary>
+		/// create state and its counter at once.
+		/// </summary>
+		static shared_ptr<State> MakeState(size_t chunk_size)
+		{
+			void* storage;
+			auto ref_count = AccesserForFactory::CreateWithStorage<counter_policy<>>(sizeof(State), alignof(State), storage);
+			State* group = new (storage) State(chunk_size);
+
+			return AccesserForFactory::Adopt<State, std::function<void(void*)>, counter_policy<>>(group, ref_count, Deleter{ group });
+		}
+
+		/// <summary>
+		/// state of group.
+		/// </summary>
+		shared_ptr<State> state;
+
+	};
+
+	/// <summary>
+	/// non thread safe unique pointer to a polymorphic object, which is placed inline if small enough.
+	/// objects larger than size or alignment, or which may throw on move, are allocated on heap.
+	/// </summary>
+	template <class Base, size_t Size = 3 * sizeof(void*), size_t Align = alignof(std::max_align_t)>
+	class inline_ptr
+	{
+		static_assert(Size >= sizeof(void*) && Align >= alignof(void*), "inline_ptr buffer must be able to hold a pointer");
+
+	public:
+		/// <summary>
+		/// check if an object of type is placed inline.
+		/// </summary>
+		template <class U>
+		static constexpr bool fits_inline = sizeof(U) <= Size && alignof(U) <= Align && std::is_nothrow_move_constructible<U>::value;
+
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		inline_ptr()
+			: ptr(nullptr)
+			, operations(nullptr)
+		{
+		}
+
+		/// <summary>
+		/// constructor taking ownership of an object on heap.
+		/// </summary>
+		template <class U>
+		explicit inline_ptr(U* target)
+			: inline_ptr()
+		{
+			reset(target);
+		}
+
+		/// <summary>
+		/// copy constractor is disabled.
+		/// </summary>
+		inline_ptr(const inline_ptr&) = delete;
+
+		/// <summary>
+		/// move constractor.
+		/// </summary>
+		inline_ptr(inline_ptr&& target) noexcept
+			: inline_ptr()
+		{
+			MoveFrom(target);
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~inline_ptr()
+		{
+			Dispose();
+		}
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		inline_ptr& operator=(const inline_ptr&) = delete;
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		inline_ptr& operator=(inline_ptr&& target) noexcept
+		{
+			assert(this != &target);
+
+			Dispose();
+			MoveFrom(target);
+
+			return *this;
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return ptr;
+		}
+
+		/// <summary>
+		/// calling members of a managing object.
+		/// </summary>
+		Base* operator->() const
+		{
+			return ptr;
+		}
+
+		/// <summary>
+		/// dereference managing object.
+		/// </summary>
+		Base& operator*() const
+		{
+			return *ptr;
+		}
+
+		/// <summary>
+		/// get rew pointer.
+		/// </summary>
+		Base* get() const
+		{
+			return ptr;
+		}
+
+		/// <summary>
+		/// check if managing object is placed inline.
+		/// </summary>
+		bool is_inline() const
+		{
+			return operations && operations->is_inline;
+		}
+
+		/// <summary>
+		/// dispose current object, and set null.
+		/// </summary>
+		void reset()
+		{
+			Dispose();
+		}
+
+		/// <summary>
+		/// dispose current object, and take ownership of an object on heap.
+		/// </summary>
+		template <class U>
+		void reset(U* target)
+		{
+			static_assert(std::is_convertible<U*, Base*>::value, "U must derive from Base");
+
+			Dispose();
+			if (!target)
+				return;
+
+			new (buffer) U*(target);
+			ptr = target;
+			operations = &HeapOperations<U>::table;
+			SMART_POINTER_NTS_LOG("retain resource: " + std::to_string((unsigned long)ptr) + " with inline ptr on heap");
+		}
+
+		/// <summary>
+		/// dispose current object, and construct new object inline or on heap.
+		/// </summary>
+		template <class U, class... Args>
+		U& emplace(Args&&... args)
+		{
+			static_assert(std::is_convertible<U*, Base*>::value, "U must derive from Base");
+
+			Dispose();
+			U* target;
+			if constexpr (fits_inline<U>)
+			{
+				target = new (buffer) U(std::forward<Args>(args)...);
+				operations = &InlineOperations<U>::table;
+			}
+			else
+			{
+				target = new U(std::forward<Args>(args)...);
+				new (buffer) U*(target);
+				operations = &HeapOperations<U>::table;
+			}
+			ptr = target;
+			SMART_POINTER_NTS_LOG("retain resource: " + std::to_string((unsigned long)ptr) + " with inline ptr");
+
+			return *target;
+		}
+
+	private:
+		/// <summary>
+		/// operations on an object of erased type in buffer.
+		/// </summary>
+		struct Operations
+		{
+			bool is_inline;
+			void (*destroy)(void* buffer);
+			Base* (*relocate)(void* from, void* to) noexcept;
+		};
+
+		/// <summary>
+		/// operations on an object placed in buffer.
+		/// </summary>
+		template <class U>
+		struct InlineOperations
+		{
+			static void Destroy(void* buffer)
+			{
+				static_cast<U*>(buffer)->~U();
+			}
+
+			static Base* Relocate(void* from, void* to) noexcept
+			{
+				U* source = static_cast<U*>(from);
+				U* destination = new (to) U(std::move(*source));
+				source->~U();
+				return destination;
+			}
+
+			static constexpr Operations table = { true, &Destroy, &Relocate };
+		};
+
+		/// <summary>
+		/// operations on an object on heap, whose pointer is placed in buffer.
+		/// </summary>
+		template <class U>
+		struct HeapOperations
+		{
+			static void Destroy(void* buffer)
+			{
+				delete *static_cast<U**>(buffer);
+			}
+
+			static Base* Relocate(void* from, void* to) noexcept
+			{
+				return *new (to) U*(*static_cast<U**>(from));
+			}
+
+			static constexpr Operations table = { false, &Destroy, &Relocate };
+		};
+
+		/// <summary>
+		/// take object from other pointer, and set it null.
+		/// </summary>
+		void MoveFrom(inline_ptr& target) noexcept
+		{
+			if (!target.ptr)
+				return;
+
+			ptr = target.operations->relocate(target.buffer, buffer);
+			operations = target.operations;
+			target.ptr = nullptr;
+			target.operations = nullptr;
+		}
+
+		/// <summary>
+		/// dispose object.
+		/// </summary>
+		void Dispose()
+		{
+			if (!ptr)
+				return;
+
+			SMART_POINTER_NTS_LOG("release resource: " + std::to_string((unsigned long)ptr) + " with inline ptr");
+			auto disposing = operations;
+			ptr = nullptr;
+			operations = nullptr;
+			disposing->destroy(buffer);
+		}
+
+		/// <summary>
+		/// pointer to managing object.
+		/// </summary>
+		Base* ptr;
+
+		/// <summary>
+		/// operations on managing object.
+		/// </summary>
+		const Operations* operations;
+
+		/// <summary>
+		/// storage of object placed inline, or pointer to object on heap.
+		/// </summary>
+		alignas(Align) unsigned char buffer[Size];
+
+	};
+
+	/// <summary>
+	/// make inline pointer.
+	/// </summary>
+	template <class Base, class U, size_t Size = 3 * sizeof(void*), size_t Align = alignof(std::max_align_t), class... Args>
+	inline_ptr<Base, Size, Align> make_inline(Args&&... args)
+	{
+		inline_ptr<Base, Size, Align> result;
+		result.template emplace<U>(std::forward<Args>(args)...);
+
+		return result;
+	}
+
+	/// <summary>
+	/// pointer storing offset from its own address, which is valid wherever a segment containing both is mapped.
+	/// offset 1 means null, so that a pointer to its own address is not taken as null.
+	/// </summary>
+	template <class T>
+	class offset_ptr
+	{
+	public:
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		offset_ptr(T* target = nullptr)
+		{
+			set(target);
+		}
+
+		/// <summary>
+		/// copy constractor, recomputing offset from new address.
+		/// </summary>
+		offset_ptr(const offset_ptr& target)
+		{
+			set(target.get());
+		}
+
+		/// <summary>
+		/// copy assignment, recomputing offset from new address.
+		/// </summary>
+		offset_ptr& operator=(const offset_ptr& target)
+		{
+			set(target.get());
+
+			return *this;
+		}
+
+		/// <summary>
+		/// calling members of a pointing object.
+		/// </summary>
+		T* operator->() const
+		{
+			return get();
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return offset != null_offset;
+		}
+
+		/// <summary>
+		/// get rew pointer.
+		/// </summary>
+		T* get() const
+		{
+			return offset != null_offset ? reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(this) + offset) : nullptr;
+		}
+
+		/// <summary>
+		/// set rew pointer.
+		/// </summary>
+		void set(T* target)
+		{
+			offset = target ? reinterpret_cast<uintptr_t>(target) - reinterpret_cast<uintptr_t>(this) : null_offset;
+		}
+
+	private:
+		/// <summary>
+		/// offset meaning null. an object is never placed 1 byte after a pointer to it.
+		/// </summary>
+		static constexpr uintptr_t null_offset = 1;
+
+		/// <summary>
+		/// offset from this to pointing object, or null_offset if null.
+		/// </summary>
+		uintptr_t offset;
+
+	};
+
+	template <class T>
+	class offset_shared_ptr;
+
+	/// <summary>
+	/// non thread safe allocator over a memory mapped segment, which can be mapped at different addresses.
+	/// all bookkeeping is stored in segment as offsets from its base, so a segment is attached again by constructing on the same bytes.
+	/// objects placed in segment must refer to each other only by offset pointers.
+	/// </summary>
+	class mapped_segment
+	{
+	public:
+		/// <summary>
+		/// alignment of every allocation.
+		/// </summary>
+		static constexpr size_t alignment = 16;
+
+		/// <summary>
+		/// constructor, attaching to a formatted segment or formatting a new one.
+		/// base must be aligned to alignment.
+		/// </summary>
+		mapped_segment(void* base, size_t size)
+			: header(static_cast<Header*>(base))
+		{
+			assert(reinterpret_cast<uintptr_t>(base) % alignment == 0);
+			if (size < first_block + alignment)
+				throw std::invalid_argument("mapped segment is too small");
+
+			is_attached = header->magic == magic;
+			if (is_attached)
+			{
+				if (size < header->top)
+					throw std::invalid_argument("mapped segment is truncated");
+			}
+			else
+			{
+				header->magic = magic;
+				header->top = first_block;
+				header->free_list = 0;
+				header->root = 0;
+				header->root_size = 0;
+			}
+			header->size = size;
+		}
+
+		/// <summary>
+		/// check if constructed on a segment formatted before.
+		/// </summary>
+		bool attached() const
+		{
+			return is_attached;
+		}
+
+		/// <summary>
+		/// allocate bytes in segment.
+		/// </summary>
+		void* allocate(size_t bytes)
+		{
+			return header->Allocate(bytes);
+		}
+
+		/// <summary>
+		/// deallocate bytes allocated in any segment.
+		/// </summary>
+		static void deallocate(void* ptr)
+		{
+			Header::Deallocate(ptr);
+		}
+
+		/// <summary>
+		/// get root object of segment, or null.
+		/// </summary>
+		template <class T>
+		offset_shared_ptr<T> root() const;
+
+		/// <summary>
+		/// set root object of segment, which is kept until replaced by an object of the same type.
+		/// </summary>
+		template <class T>
+		void set_root(const offset_shared_ptr<T>& target);
+
+	private:
+		/// <summary>
+		/// header of an allocation.
+		/// </summary>
+		struct BlockHeader
+		{
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		/// <summary>
+		/// header of segment, placed at its base.
+		/// </summary>
+		struct Header
+		{
+			uint64_t magic;
+			uint64_t size;
+			uint64_t top;
+			uint64_t free_list;
+			uint64_t root;
+			uint64_t root_size;
+
+			/// <summary>
+			/// allocate first fit block from free list, or from top of segment.
+			/// </summary>
+			void* Allocate(size_t bytes)
+			{
+				uint64_t needed = (bytes + sizeof(BlockHeader) + alignment - 1) / alignment * alignment;
+				if (needed < min_block)
+					needed = min_block;
+
+				for (uint64_t* link = &free_list; *link; link = &NextFree(At(*link)))
+				{
+					BlockHeader* block = At(*link);
+					if (block->size < needed)
+						continue;
+
+					if (block->size - needed >= min_block)
+					{
+						BlockHeader* rest = At(block->offset + needed);
+						rest->offset = block->offset + needed;
+						rest->size = block->size - needed;
+						NextFree(rest) = NextFree(block);
+						block->size = needed;
+						*link = rest->offset;
+					}
+					else
+					{
+						*link = NextFree(block);
+					}
+					return block + 1;
+				}
+
+				if (size - top < needed)
+					throw std::bad_alloc();
+
+				BlockHeader* block = At(top);
+				block->offset = top;
+				block->size = needed;
+				top += needed;
+
+				return block + 1;
+			}
+
+			/// <summary>
+			/// return block to free list ordered by offset, merging it with adjacent free blocks.
+			/// a free block reaching top of segment is returned to top.
+			/// </summary>
+			static void Deallocate(void* ptr)
+			{
+				if (!ptr)
+					return;
+
+				BlockHeader* block = static_cast<BlockHeader*>(ptr) - 1;
+				Header* header = reinterpret_cast<Header*>(reinterpret_cast<char*>(block) - block->offset);
+				header->Release(block);
+			}
+
+			/// <summary>
+			/// insert block into free list, keeping order by offset.
+			/// </summary>
+			void Release(BlockHeader* block)
+			{
+				uint64_t* previous_link = nullptr;
+				uint64_t* link = &free_list;
+				while (*link && *link < block->offset)
+				{
+					previous_link = link;
+					link = &NextFree(At(*link));
+				}
+
+				uint64_t begin = block->offset;
+				uint64_t end = block->offset + block->size;
+				uint64_t following = *link;
+				if (following && following == end)
+				{
+					end += At(following)->size;
+					following = NextFree(At(following));
+				}
+
+				BlockHeader* previous = previous_link ? At(*previous_link) : nullptr;
+				bool merged = previous && previous->offset + previous->size == begin;
+				if (merged)
+				{
+					begin = previous->offset;
+					link = previous_link;
+				}
+
+				if (end == top)
+				{
+					// the last free block is given back to top.
+					top = begin;
+					*link = following;
+					return;
+				}
+
+				BlockHeader* result = At(begin);
+				result->offset = begin;
+				result->size = end - begin;
+				NextFree(result) = following;
+				*link = begin;
+			}
+
+			BlockHeader* At(uint64_t offset)
+			{
+				return reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(this) + offset);
+			}
+
+			static uint64_t& NextFree(BlockHeader* block)
+			{
+				return *reinterpret_cast<uint64_t*>(block + 1);
+			}
+		};
+
+		static constexpr uint64_t magic = 0x736d61727470746eULL;
+		static constexpr uint64_t first_block = (sizeof(Header) + alignment - 1) / alignment * alignment;
+		static constexpr uint64_t min_block = sizeof(BlockHeader) + alignment;
+
+		/// <summary>
+		/// header of segment.
+		/// </summary>
+		Header* header;
+
+		/// <summary>
+		/// whether segment was formatted before.
+		/// </summary>
+		bool is_attached;
+
+	};
+
+	/// <summary>
+	/// non thread safe unique pointer to an object in mapped segment.
+	/// object is destroyed as T and returned to its segment, so T must be the dynamic type.
+	/// </summary>
+	template <class T>
+	class offset_unique_ptr
+	{
+	public:
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		offset_unique_ptr()
+		{
+		}
+
+		/// <summary>
+		/// copy constractor is disabled.
+		/// </summary>
+		offset_unique_ptr(const offset_unique_ptr&) = delete;
+
+		/// <summary>
+		/// move constractor.
+		/// </summary>
+		offset_unique_ptr(offset_unique_ptr&& target)
+			: ptr(target.get())
+		{
+			target.ptr.set(nullptr);
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~offset_unique_ptr()
+		{
+			reset();
+		}
+
+		/// <summary>
+		/// copy assignment is disabled.
+		/// </summary>
+		offset_unique_ptr& operator=(const offset_unique_ptr&) = delete;
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		offset_unique_ptr& operator=(offset_unique_ptr&& target)
+		{
+			assert(this != &target);
+
+			reset();
+			ptr.set(target.get());
+			target.ptr.set(nullptr);
+
+			return *this;
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return static_cast<bool>(ptr);
+		}
+
+		/// <summary>
+		/// calling members of a managing object.
+		/// </summary>
+		T* operator->() const
+		{
+			return get();
+		}
+
+		/// <summary>
+		/// get rew pointer.
+		/// </summary>
+		T* get() const
+		{
+			return ptr.get();
+		}
+
+		/// <summary>
+		/// dispose current object, and set null.
+		/// </summary>
+		void reset()
+		{
+			T* disposing = get();
+			if (!disposing)
+				return;
+
+			ptr.set(nullptr);
+			disposing->~T();
+			mapped_segment::deallocate(disposing);
+		}
+
+		template <class U, class... Args>
+		friend offset_unique_ptr<U> make_offset_unique(mapped_segment& segment, Args&&... args);
+
+	private:
+		/// <summary>
+		/// offset to managing object.
+		/// </summary>
+		offset_ptr<T> ptr;
+
+	};
+
+	/// <summary>
+	/// non thread safe shared pointer to an object in mapped segment.
+	/// counter and object are placed together in segment.
+	/// </summary>
+	template <class T>
+	class offset_shared_ptr
+	{
+	public:
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		offset_shared_ptr()
+		{
+		}
+
+		/// <summary>
+		/// copy constractor.
+		/// </summary>
+		offset_shared_ptr(const offset_shared_ptr& target)
+			: block(target.block)
+		{
+			if (block)
+				++block->count;
+		}
+
+		/// <summary>
+		/// move constractor.
+		/// </summary>
+		offset_shared_ptr(offset_shared_ptr&& target)
+			: block(target.block)
+		{
+			target.block.set(nullptr);
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~offset_shared_ptr()
+		{
+			reset();
+		}
+
+		/// <summary>
+		/// copy assignment.
+		/// </summary>
+		offset_shared_ptr& operator=(const offset_shared_ptr& target)
+		{
+			if (block.get() == target.block.get())
+				return *this;
+
+			if (target.block)
+				++target.block->count;
+			reset();
+			block = target.block;
+
+			return *this;
+		}
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		offset_shared_ptr& operator=(offset_shared_ptr&& target)
+		{
+			assert(this != &target);
+
+			reset();
+			block = target.block;
+			target.block.set(nullptr);
+
+			return *this;
+		}
+
+		/// <summary>
+		/// check if pointer is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return static_cast<bool>(block);
+		}
+
+		/// <summary>
+		/// calling members of a managing object.
+		/// </summary>
+		T* operator->() const
+		{
+			return get();
+		}
+
+		/// <summary>
+		/// get rew pointer.
+		/// </summary>
+		T* get() const
+		{
+			return block ? &block->value : nullptr;
+		}
+
+		/// <summary>
+		/// get reference count.
+		/// </summary>
+		long use_count() const
+		{
+			return block ? static_cast<long>(block->count) : 0;
+		}
+
+		/// <summary>
+		/// release current object, and set null.
+		/// </summary>
+		void reset()
+		{
+			Block* releasing = block.get();
+			if (!releasing)
+				return;
+
+			block.set(nullptr);
+			if (--releasing->count == 0)
+			{
+				releasing->~Block();
+				mapped_segment::deallocate(releasing);
+			}
+		}
+
+		template <class U, class... Args>
+		friend offset_shared_ptr<U> make_offset_shared(mapped_segment& segment, Args&&... args);
+
+		friend class mapped_segment;
+
+	private:
+		/// <summary>
+		/// counter and object.
+		/// </summary>
+		struct Block
+		{
+			template <class... Args>
+			Block(Args&&... args)
+				: count(1)
+				, value(std::forward<Args>(args)...)
+			{
+			}
+
+			uint64_t count;
+			T value;
+		};
+
+		/// <summary>
+		/// offset to counter and object.
+		/// </summary>
+		offset_ptr<Block> block;
+
+	};
+
+	/// <summary>
+	/// make unique pointer to an object in mapped segment.
+	/// </summary>
+	template <class T, class... Args>
+	offset_unique_ptr<T> make_offset_unique(mapped_segment& segment, Args&&... args)
+	{
+		static_assert(alignof(T) <= mapped_segment::alignment, "mapped_segment does not support over-aligned types");
+
+		void* storage = segment.allocate(sizeof(T));
+		offset_unique_ptr<T> result;
+		try
+		{
+			result.ptr.set(new (storage) T(std::forward<Args>(args)...));
+		}
+		catch (...)
+		{
+			mapped_segment::deallocate(storage);
+			throw;
+		}
+
+		return result;
+	}
+
+	/// <summary>
+	/// make shared pointer to an object in mapped segment, allocating counter and object at once.
+	/// </summary>
+	template <class T, class... Args>
+	offset_shared_ptr<T> make_offset_shared(mapped_segment& segment, Args&&... args)
+	{
+		using Block = typename offset_shared_ptr<T>::Block;
+		static_assert(alignof(Block) <= mapped_segment::alignment, "mapped_segment does not support over-aligned types");
+
+		void* storage = segment.allocate(sizeof(Block));
+		offset_shared_ptr<T> result;
+		try
+		{
+			result.block.set(new (storage) Block(std::forward<Args>(args)...));
+		}
+		catch (...)
+		{
+			mapped_segment::deallocate(storage);
+			throw;
+		}
+
+		return result;
+	}
+
+	template <class T>
+	offset_shared_ptr<T> mapped_segment::root() const
+	{
+		offset_shared_ptr<T> result;
+		if (!header->root)
+			return result;
+
+		assert(header->root_size == sizeof(typename offset_shared_ptr<T>::Block));
+		auto block = reinterpret_cast<typename offset_shared_ptr<T>::Block*>(reinterpret_cast<char*>(header) + header->root);
+		++block->count;
+		result.block.set(block);
+
+		return result;
+	}
+
+	template <class T>
+	void mapped_segment::set_root(const offset_shared_ptr<T>& target)
+	{
+		// the slot owns one reference as a shared pointer placed out of segment
+		offset_shared_ptr<T> previous = root<T>();
+		if (header->root)
+			--previous.block->count;
+
+		offset_shared_ptr<T> holding = target;
+		auto block = holding.block.get();
+		header->root = block ? reinterpret_cast<char*>(block) - reinterpret_cast<char*>(header) : 0;
+		header->root_size = block ? sizeof(*block) : 0;
+		holding.block.set(nullptr);
+	}
+
+	template <class T>
+	std::vector<unsigned char> serialize_graph(shared_ptr<T>& root);
+
+	template <class T>
+	shared_ptr<T> deserialize_graph(const void* data, size_t size);
+
+	/// <summary>
+	/// archive writing a graph of shared objects, each of which is written once.
+	/// an object of type T is written by calling T::serialize(archive), which passes each field to archive(field).
+	/// fields may be trivially copyable values, strings, vectors of fields, shared pointers and weak pointers.
+	/// </summary>
+	class graph_writer
+	{
+	public:
+		/// <summary>
+		/// write trivially copyable value.
+		/// raw pointers are rejected, because addresses are meaningless in another process.
+		/// </summary>
+		template <class U>
+		auto operator()(U& value) -> typename std::enable_if<std::is_trivially_copyable<U>::value>::type
+		{
+			static_assert(!std::is_pointer<U>::value && !std::is_member_pointer<U>::value, "raw pointer can not be serialized. use shared_ptr or weak_ptr instead.");
+			Write(&value, sizeof(U));
+		}
+
+		/// <summary>
+		/// write string.
+		/// </summary>
+		void operator()(std::string& value)
+		{
+			uint64_t length = value.size();
+			(*this)(length);
+			Write(value.data(), value.size());
+		}
+
+		/// <summary>
+		/// write fields in vector.
+		/// </summary>
+		template <class U>
+		void operator()(std::vector<U>& values)
+		{
+			uint64_t length = values.size();
+			(*this)(length);
+			for (auto& value : values)
+				(*this)(value);
+		}
+
+		/// <summary>
+		/// write id of shared object, collecting it at first time.
+		/// </summary>
+		template <class T>
+		void operator()(shared_ptr<T>& target)
+		{
+			uint64_t id = 0;
+			if (target.get())
+				id = collecting ? Collect(target.get(), AccesserForFactory::GetRefCounter(target), &Visit<T>) : Find(target.get(), AccesserForFactory::GetRefCounter(target));
+			(*this)(id);
+		}
+
+		/// <summary>
+		/// write id of observing object, or 0 if it is not reachable by shared pointers.
+		/// </summary>
+		template <class T>
+		void operator()(weak_ptr<T>& target)
+		{
+			uint64_t id = 0;
+			if (!collecting)
+			{
+				auto locked = target.lock();
+				if (locked.get())
+					id = Find(locked.get(), AccesserForFactory::GetRefCounter(locked));
+			}
+			(*this)(id);
+		}
+
+		template <class T>
+		friend std::vector<unsigned char> serialize_graph(shared_ptr<T>& root);
+
+	private:
+		/// <summary>
+		/// object collected in graph.
+		/// </summary>
+		struct Object
+		{
+			void* raw;
+			void (*visit)(graph_writer& writer, void* raw);
+		};
+
+		graph_writer()
+			: collecting(true)
+		{
+		}
+
+		/// <summary>
+		/// visit fields of an object.
+		/// </summary>
+		template <class T>
+		static void Visit(graph_writer& writer, void* raw)
+		{
+			static_cast<T*>(raw)->serialize(writer);
+		}
+
+		/// <summary>
+		/// assign id to an object identified by its counter.
+		/// </summary>
+		uint64_t Collect(void* raw, const void* ref_count, void (*visit)(graph_writer&, void*))
+		{
+			auto inserted = ids.insert(std::make_pair(ref_count, objects.size() + 1));
+			if (inserted.second)
+				objects.push_back(Object{ raw, visit });
+			else if (objects[inserted.first->second - 1].raw != raw)
+				throw std::invalid_argument("shared pointers aliasing one counter are not serializable");
+
+			return inserted.first->second;
+		}
+
+		/// <summary>
+		/// find id of a collected object, or 0.
+		/// </summary>
+		uint64_t Find(void* raw, const void* ref_count) const
+		{
+			auto found = ids.find(ref_count);
+			if (found == ids.end() || objects[found->second - 1].raw != raw)
+				return 0;
+
+			return found->second;
+		}
+
+		/// <summary>
+		/// visit all collected objects in order of their ids.
+		/// objects found while visiting are appended, so graph is traversed in breadth first order.
+		/// </summary>
+		void VisitAll()
+		{
+			for (size_t i = 0; i < objects.size(); ++i)
+				objects[i].visit(*this, objects[i].raw);
+		}
+
+		void Write(const void* data, size_t size)
+		{
+			if (!collecting)
+				bytes.insert(bytes.end(), static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+		}
+
+		bool collecting;
+		std::unordered_map<const void*, uint64_t> ids;
+		std::vector<Object> objects;
+		std::vector<unsigned char> bytes;
+	};
+
+	/// <summary>
+	/// archive reading a graph written by graph_writer.
+	/// each object is made by make_shared of its default constructor at its first reference, and then its fields are read.
+	/// objects are not placed in one arena, because each counter is deleted on its own when its last owner and observer are gone,
+	/// so one allocation per object holding the object and its counter is the least.
+	/// shared and weak pointers read must be stored in fields of objects in graph.
+	/// objects made before a corrupted content is found may leak if they form cycles.
+	/// </summary>
+	class graph_reader
+	{
+	public:
+		/// <summary>
+		/// read trivially copyable value.
+		/// raw pointers are rejected, because addresses are meaningless in another process.
+		/// </summary>
+		template <class U>
+		auto operator()(U& value) -> typename std::enable_if<std::is_trivially_copyable<U>::value>::type
+		{
+			static_assert(!std::is_pointer<U>::value && !std::is_member_pointer<U>::value, "raw pointer can not be serialized. use shared_ptr or weak_ptr instead.");
+			Read(&value, sizeof(U));
+		}
+
+		/// <summary>
+		/// read string.
+		/// </summary>
+		void operator()(std::string& value)
+		{
+			uint64_t length;
+			(*this)(length);
+			value.assign(static_cast<const char*>(Consume(length)), length);
+		}
+
+		/// <summary>
+		/// read fields in vector.
+		/// </summary>
+		template <class U>
+		void operator()(std::vector<U>& values)
+		{
+			uint64_t length;
+			(*this)(length);
+			if (length > size)
+				throw std::out_of_range("graph stream is truncated");
+
+			values.resize(length);
+			for (auto& value : values)
+				(*this)(value);
+		}
+
+		/// <summary>
+		/// read shared object, making it at first reference.
+		/// </summary>
+		template <class T>
+		void operator()(shared_ptr<T>& target)
+		{
+			uint64_t id;
+			(*this)(id);
+			if (id == 0)
+			{
+				target.reset();
+			}
+			else if (id == made + 1 && made < objects.size())
+			{
+				target = make_shared<T>();
+				objects[made++] = Object{ target.get(), AccesserForFactory::GetRefCounter(target), &TypeTag<T>::id };
+				pending.push_back(Pending{ target.get(), &Visit<T> });
+			}
+			else
+			{
+				target = Share<T>(id);
+			}
+		}
+
+		/// <summary>
+		/// read observing object, resolving it when all objects are made.
+		/// </summary>
+		template <class T>
+		void operator()(weak_ptr<T>& target)
+		{
+			uint64_t id;
+			(*this)(id);
+			if (id == 0)
+			{
+				target.reset();
+			}
+			else if (id <= made)
+			{
+				auto shared = Share<T>(id);
+				target = shared;
+			}
+			else if (id <= objects.size())
+			{
+				fixups.push_back(Fixup{ &target, id, &Resolve<T> });
+			}
+			else
+			{
+				throw std::invalid_argument("graph stream is corrupted");
+			}
+		}
+
+		template <class T>
+		friend shared_ptr<T> deserialize_graph(const void* data, size_t size);
+
+	private:
+		/// <summary>
+		/// object made in graph.
+		/// </summary>
+		struct Object
+		{
+			void* raw;
+			SharedPtrRefCounter* ref_count;
+			const void* type;
+		};
+
+		/// <summary>
+		/// object whose fields are not read yet.
+		/// </summary>
+		struct Pending
+		{
+			void* raw;
+			void (*visit)(graph_reader& reader, void* raw);
+		};
+
+		/// <summary>
+		/// weak pointer referring an object not made yet.
+		/// </summary>
+		struct Fixup
+		{
+			void* target;
+			uint64_t id;
+			void (*resolve)(graph_reader& reader, void* target, uint64_t id);
+		};
+
+		graph_reader(const void* data, size_t size)
+			: data(static_cast<const unsigned char*>(data))
+			, size(size)
+			, made(0)
+		{
+		}
+
+		/// <summary>
+		/// address identifying type.
+		/// </summary>
+		template <class T>
+		struct TypeTag
+		{
+			static constexpr char id = 0;
+		};
+
+		template <class T>
+		static void Visit(graph_reader& reader, void* raw)
+		{
+			static_cast<T*>(raw)->serialize(reader);
+		}
+
+		template <class T>
+		static void Resolve(graph_reader& reader, void* target, uint64_t id)
+		{
+			auto shared = reader.Share<T>(id);
+			*static_cast<weak_ptr<T>*>(target) = shared;
+		}
+
+		/// <summary>
+		/// make another owner of an object made before.
+		/// </summary>
+		template <class T>
+		shared_ptr<T> Share(uint64_t id)
+		{
+			if (id == 0 || id > made)
+				throw std::invalid_argument("graph stream is corrupted");
+
+			const Object& object = objects[id - 1];
+			if (object.type != &TypeTag<T>::id)
+				throw std::invalid_argument("graph stream has mismatched type");
+
+			return AccesserForFactory::Share<T, std::function<void(void*)>, counter_policy<>>(
+				static_cast<T*>(object.raw), object.ref_count, &AccesserForFactory::DestroyInPlace<T>);
+		}
+
+		const void* Consume(size_t length)
+		{
+			if (length > size)
+				throw std::out_of_range("graph stream is truncated");
+
+			const void* result = data;
+			data += length;
+			size -= length;
+
+			return result;
+		}
+
+		void Read(void* value, size_t length)
+		{
+			auto source = static_cast<const unsigned char*>(Consume(length));
+			std::copy(source, source + length, static_cast<unsigned char*>(value));
+		}
+
+		const unsigned char* data;
+		size_t size;
+		size_t made;
+		std::vector<Object> objects;
+		std::vector<Pending> pending;
+		std::vector<Fixup> fixups;
+	};
+
+	/// <summary>
+	/// magic number at the head of graph stream.
+	/// </summary>
+	constexpr uint32_t graph_stream_magic = 0x474e5053;
+
+	/// <summary>
+	/// serialize graph reachable from root, preserving sharing and weak pointers among its objects.
+	/// values are written in native byte order.
+	/// </summary>
+	template <class T>
+	std::vector<unsigned char> serialize_graph(shared_ptr<T>& root)
+	{
+		graph_writer writer;
+		writer(root);
+		writer.VisitAll();
+
+		writer.collecting = false;
+		uint32_t magic = graph_stream_magic;
+		uint64_t length = 0;
+		uint64_t count = writer.objects.size();
+		writer(magic);
+		writer(length);
+		writer(count);
+		writer(root);
+		writer.VisitAll();
+
+		// length is checked before making any object, since a partial graph may leak by cycles
+		length = writer.bytes.size();
+		std::copy(reinterpret_cast<unsigned char*>(&length), reinterpret_cast<unsigned char*>(&length + 1), writer.bytes.begin() + sizeof(magic));
+
+		return std::move(writer.bytes);
+	}
+
+	/// <summary>
+	/// deserialize graph written by serialize_graph, and get its root.
+	/// the stream is read in one pass, and tables for objects are reserved at once by the count in its header.
+	/// </summary>
+	template <class T>
+	shared_ptr<T> deserialize_graph(const void* data, size_t size)
+	{
+		graph_reader reader(data, size);
+		uint32_t magic;
+		uint64_t length;
+		uint64_t count;
+		reader(magic);
+		reader(length);
+		reader(count);
+		if (magic != graph_stream_magic || count > size)
+			throw std::invalid_argument("graph stream is corrupted");
+		if (length != size)
+			throw std::out_of_range("graph stream is truncated");
+		reader.objects.resize(count);
+		reader.pending.reserve(count);
+
+		shared_ptr<T> root;
+		reader(root);
+		for (size_t i = 0; i < reader.pending.size(); ++i)
+			reader.pending[i].visit(reader, reader.pending[i].raw);
+		if (reader.made != count)
+			throw std::invalid_argument("graph stream is corrupted");
+
+		for (auto& fixup : reader.fixups)
+			fixup.resolve(reader, fixup.target, fixup.id);
+
+		return root;
+	}
+
+	/// <summary>
+	/// deserialize graph written by serialize_graph, and get its root.
+	/// </summary>
+	template <class T>
+	shared_ptr<T> deserialize_graph(const std::vector<unsigned char>& bytes)
+	{
+		return deserialize_graph<T>(bytes.data(), bytes.size());
+	}
+
+	/// <summary>
+	/// non thread safe unique pointer whose object is placed together with a reserved counter,
+	/// so that promoting it to shared pointer needs no allocation.
+	/// </summary>
+	template <class T0, class Policy = counter_policy<>>
+	class reserved_unique_ptr : public unique_ptr<T0>
+	{
+	public:
+		using T = typename unique_ptr<T0>::T;
+		using UniquePtrBase = unique_ptr<T0>;
+		using RefCounter = BasicSharedPtrRefCounter<Policy>;
+
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		reserved_unique_ptr()
+			: UniquePtrBase()
+			, ref_count(nullptr)
+		{
+		}
+
+		/// <summary>
+		/// move constractor.
+		/// </summary>
+		reserved_unique_ptr(reserved_unique_ptr&& target)
+			: UniquePtrBase(std::move(target))
+			, ref_count(target.ref_count)
+		{
+			target.ref_count = nullptr;
+		}
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		reserved_unique_ptr& operator=(reserved_unique_ptr&& target) noexcept
+		{
+			UniquePtrBase::operator=(std::move(target));
+			this->ref_count = target.ref_count;
+			target.ref_count = nullptr;
+
+			return *this;
+		}
+
+		/// <summary>
+		/// dispose current object with its counter, and set null.
+		/// </summary>
+		void reset()
+		{
+			UniquePtrBase::reset();
+			this->ref_count = nullptr;
+		}
+
+		/// <summary>
+		/// another resource cannot be set, because counter is placed with current object.
+		/// </summary>
+		template<class U>
+		void reset(U* ptr) = delete;
+
+		/// <summary>
+		/// object cannot be released, because it is placed with counter.
+		/// </summary>
+		T* release() = delete;
+
+		template <class U, class P, class... Args>
+		friend auto make_reserved_unique(Args&&... args) -> typename std::enable_if<!std::is_array<U>::value, reserved_unique_ptr<U, P>>::type;
+
+		friend class shared_ptr<T0, std::function<void(void*)>, Policy>;
+
+	private:
+		/// <summary>
+		/// constructor with an object placed after its counter.
+		/// </summary>
+		reserved_unique_ptr(T* ptr, RefCounter* ref_count)
+			: UniquePtrBase(ptr, [ref_count](void* obj) { static_cast<T*>(obj)->~T(); AccesserForFactory::Destroy(ref_count); })
+			, ref_count(ref_count)
+		{
+		}
+
+		/// <summary>
+		/// give up object and counter for shared pointer.
+		/// </summary>
+		RefCounter* Detach()
+		{
+			auto result = this->ref_count;
+			this->ref_count = nullptr;
+			UniquePtrBase::release();
+
+			return result;
+		}
+
+		/// <summary>
+		/// reserved counter.
+		/// </summary>
+		RefCounter* ref_count;
+
+	};
+
+	/// <summary>
+	/// make unique pointer of a new object, reserving counter for promoting it to shared pointer.
+	/// the object and its counter are allocated at once.
+	/// </summary>
+	template <class T, class Policy = counter_policy<>, class... Args>
+	auto make_reserved_unique(Args&&... args) -> typename std::enable_if<!std::is_array<T>::value, reserved_unique_ptr<T, Policy>>::type
+	{
+		void* storage;
+		auto ref_count = AccesserForFactory::CreateWithStorage<Policy>(sizeof(T), alignof(T), storage);
+
+		T* obj;
+		try
+		{
+			obj = new (storage) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			AccesserForFactory::Destroy(ref_count);
+			throw;
+		}
+		return reserved_unique_ptr<T, Policy>(obj, ref_count);
+	}
+
+	/// <summary>
+	/// non thread safe reference counted bytes placed just after their counter.
+	/// a buffer is a view of the bytes, and its slices share the counter without copying bytes.
+	/// </summary>
+	class rc_buffer
+	{
+	public:
+		/// <summary>
+		/// constructor with empty view.
+		/// </summary>
+		rc_buffer()
+			: ref_count(nullptr)
+			, bytes(nullptr)
+			, length(0)
+		{
+		}
+
+		/// <summary>
+		/// constructor allocating uninitialized bytes.
+		/// </summary>
+		explicit rc_buffer(size_t size)
+			: rc_buffer()
+		{
+			void* storage;
+			ref_count = SharedPtrRefCounter::CreateWithStorage(size, 1, storage);
+			bytes = static_cast<unsigned char*>(storage);
+			length = size;
+		}
+
+		/// <summary>
+		/// constructor copying bytes.
+		/// </summary>
+		rc_buffer(const void* data, size_t size)
+			: rc_buffer(size)
+		{
+			std::copy(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size, bytes);
+		}
+
+		/// <summary>
+		/// copy constructor.
+		/// </summary>
+		rc_buffer(const rc_buffer& target)
+			: ref_count(AcquireOwner(target.ref_count))
+			, bytes(target.bytes)
+			, length(target.length)
+		{
+		}
+
+		/// <summary>
+		/// move constractor.
+		/// </summary>
+		rc_buffer(rc_buffer&& target) noexcept
+			: ref_count(target.ref_count)
+			, bytes(target.bytes)
+			, length(target.length)
+		{
+			target.ref_count = nullptr;
+			target.bytes = nullptr;
+			target.length = 0;
+		}
+
+		/// <summary>
+		/// destructor.
+		/// </summary>
+		~rc_buffer()
+		{
+			Dispose();
+		}
+
+		/// <summary>
+		/// copy assignment.
+		/// </summary>
+		rc_buffer& operator=(const rc_buffer& target)
+		{
+			AcquireOwner(target.ref_count);
+			Dispose();
+			ref_count = target.ref_count;
+			bytes = target.bytes;
+			length = target.length;
+
+			return *this;
+		}
+
+		/// <summary>
+		/// move assignment.
+		/// </summary>
+		rc_buffer& operator=(rc_buffer&& target) noexcept
+		{
+			assert(this != &target);
+
+			Dispose();
+			ref_count = target.ref_count;
+			bytes = target.bytes;
+			length = target.length;
+			target.ref_count = nullptr;
+			target.bytes = nullptr;
+			target.length = 0;
+
+			return *this;
+		}
+
+		/// <summary>
+		/// get first byte of view.
+		/// </summary>
+		unsigned char* data() const
+		{
+			return bytes;
+		}
+
+		/// <summary>
+		/// count bytes in view.
+		/// </summary>
+		size_t size() const
+		{
+			return length;
+		}
+
+		/// <summary>
+		/// check if view is empty.
+		/// </summary>
+		bool empty() const
+		{
+			return length == 0;
+		}
+
+		unsigned char* begin() const
+		{
+			return bytes;
+		}
+
+		unsigned char* end() const
+		{
+			return bytes + length;
+		}
+
+		/// <summary>
+		/// access byte in view.
+		/// </summary>
+		unsigned char& operator[](size_t index) const
+		{
+			assert(index < length);
+			return bytes[index];
+		}
+
+		/// <summary>
+		/// get view of a part of bytes, sharing counter.
+		/// </summary>
+		rc_buffer slice(size_t offset, size_t size) const
+		{
+			if (offset > length || size > length - offset)
+				throw std::out_of_range("slice is out of buffer");
+
+			rc_buffer result(*this);
+			result.bytes += offset;
+			result.length = size;
+
+			return result;
+		}
+
+		/// <summary>
+		/// get reference count shared by slices.
+		/// </summary>
+		long use_count() const
+		{
+			return ref_count ? ref_count->CountOwners() : 0;
+		}
+
+#ifdef __cpp_lib_span
+		/// <summary>
+		/// get view as span.
+		/// </summary>
+		std::span<unsigned char> span() const
+		{
+			return std::span<unsigned char>(bytes, length);
+		}
+
+		/// <summary>
+		/// convert view to span.
+		/// </summary>
+		operator std::span<unsigned char>() const
+		{
+			return span();
+		}
+
+		/// <summary>
+		/// convert view to span of const bytes.
+		/// </summary>
+		operator std::span<const unsigned char>() const
+		{
+			return std::span<const unsigned char>(bytes, length);
+		}
+#endif
+
+	private:
+		static SharedPtrRefCounter* AcquireOwner(SharedPtrRefCounter* ref_count)
+		{
+			if (ref_count)
+				ref_count->IncreaseOwner();
+
+			return ref_count;
+		}
+
+		void Dispose()
+		{
+			auto released = ref_count;
+			ref_count = nullptr;
+			bytes = nullptr;
+			length = 0;
+			if (released && released->DecreaseOwner() == 0)
+				released->DisposeResource([]() {});
+		}
+
+		/// <summary>
+		/// counter heading the block of bytes.
+		/// </summary>
+		SharedPtrRefCounter* ref_count;
+
+		/// <summary>
+		/// first byte of view.
+		/// </summary>
+		unsigned char* bytes;
+
+		/// <summary>
+		/// count of bytes in view.
+		/// </summary>
+		size_t length;
+
+	};
+
+	/// <summary>
+	/// sequence of reference counted buffers, for scatter gather I/O without copying.
+	/// </summary>
+	class rc_buffer_chain
+	{
+	public:
+		/// <summary>
+		/// append buffer at the end.
+		/// </summary>
+		void append(rc_buffer buffer)
+		{
+			if (buffer.empty())
+				return;
+
+			total += buffer.size();
+			fragments.push_back(std::move(buffer));
+		}
+
+		/// <summary>
+		/// count bytes in all buffers.
+		/// </summary>
+		size_t size() const
+		{
+			return total;
+		}
+
+		/// <summary>
+		/// get buffers in order, such as for vectored write.
+		/// </summary>
+		const std::vector<rc_buffer>& buffers() const
+		{
+			return fragments;
+		}
+
+		/// <summary>
+		/// get chain of a part of bytes, sharing counters of buffers.
+		/// </summary>
+		rc_buffer_chain slice(size_t offset, size_t size) const
+		{
+			if (offset > total || size > total - offset)
+				throw std::out_of_range("slice is out of buffer chain");
+
+			rc_buffer_chain result;
+			for (auto& fragment : fragments)
+			{
+				if (!size)
+					break;
+
+				if (offset >= fragment.size())
+				{
+					offset -= fragment.size();
+					continue;
+				}
+
+				size_t taking = fragment.size() - offset < size ? fragment.size() - offset : size;
+				result.append(fragment.slice(offset, taking));
+				offset = 0;
+				size -= taking;
+			}
+
+			return result;
+		}
+
+		/// <summary>
+		/// gather all bytes into one buffer. a single buffer is shared without copying.
+		/// </summary>
+		rc_buffer gather() const
+		{
+			if (fragments.size() == 1)
+				return fragments.front();
+
+			rc_buffer result(total);
+			unsigned char* cursor = result.data();
+			for (auto& fragment : fragments)
+				cursor = std::copy(fragment.begin(), fragment.end(), cursor);
+
+			return result;
+		}
+
+	private:
+		/// <summary>
+		/// buffers in order.
+		/// </summary>
+		std::vector<rc_buffer> fragments;
+
+		/// <summary>
+		/// count of bytes in all buffers.
+		/// </summary>
+		size_t total = 0;
+
+	};
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+	template <class T>
+	class shared_task;
+
+	/// <summary>
+	/// common part of promise of shared task.
+	/// the coroutine frame is allocated after a counter, and owned by shared pointers to the promise.
+	/// </summary>
+	class shared_task_promise_base
+	{
+	public:
+		/// <summary>
+		/// allocate coroutine frame after its counter.
+		/// </summary>
+		static void* operator new(size_t size)
+		{
+			void* storage;
+			AccesserForFactory::CreateWithStorage<counter_policy<>>(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, storage);
+
+			return storage;
+		}
+
+		/// <summary>
+		/// deallocate coroutine frame which has never been owned.
+		/// a frame which has been owned is deallocated with its counter, after the last owner and observer.
+		/// </summary>
+		static void operator delete(void* ptr, size_t)
+		{
+			auto ref_count = AccesserForFactory::CounterOfStorage<counter_policy<>>(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+			if (AccesserForFactory::CountOwners(ref_count))
+				AccesserForFactory::Destroy(ref_count);
+		}
+
+		/// <summary>
+		/// start running at once.
+		/// </summary>
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		/// <summary>
+		/// awaiter resuming waiters when finished. the frame is kept until its owners are gone.
+		/// </summary>
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			template <class Promise>
+			void await_suspend(std::coroutine_handle<Promise> handle) noexcept
+			{
+				// waiters may release the last owner of this frame.
+				auto waiters = std::move(handle.promise().waiters);
+				for (auto waiter : waiters)
+					waiter.resume();
+			}
+
+			void await_resume() noexcept
+			{
+			}
+		};
+
+		FinalAwaiter final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void unhandled_exception()
+		{
+			exception = std::current_exception();
+		}
+
+		/// <summary>
+		/// register coroutine resumed when finished.
+		/// </summary>
+		void Await(std::coroutine_handle<> waiter)
+		{
+			waiters.push_back(waiter);
+		}
+
+	protected:
+		/// <summary>
+		/// adopt owner of counter allocated with this frame.
+		/// </summary>
+		template <class Promise>
+		shared_ptr<Promise> Adopt(Promise* promise)
+		{
+			void* frame = std::coroutine_handle<Promise>::from_promise(*promise).address();
+			auto ref_count = AccesserForFactory::CounterOfStorage<counter_policy<>>(frame, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+			return AccesserForFactory::Adopt<Promise, std::function<void(void*)>, counter_policy<>>(promise, ref_count, &DestroyFrame<Promise>);
+		}
+
+		void RethrowIfFailed() const
+		{
+			if (exception)
+				std::rethrow_exception(exception);
+		}
+
+	private:
+		template <class Promise>
+		static void DestroyFrame(void* promise)
+		{
+			std::coroutine_handle<Promise>::from_promise(*static_cast<Promise*>(promise)).destroy();
+		}
+
+		std::vector<std::coroutine_handle<>> waiters;
+		std::exception_ptr exception;
+	};
+
+	/// <summary>
+	/// promise of shared task with result.
+	/// </summary>
+	template <class T>
+	class shared_task_promise : public shared_task_promise_base
+	{
+	public:
+		shared_task<T> get_return_object()
+		{
+			return shared_task<T>(Adopt(this));
+		}
+
+		template <class U>
+		void return_value(U&& value)
+		{
+			result.emplace(std::forward<U>(value));
+		}
+
+		/// <summary>
+		/// get result, or rethrow exception of coroutine.
+		/// </summary>
+		const T& Result() const
+		{
+			RethrowIfFailed();
+			return *result;
+		}
+
+	private:
+		std::optional<T> result;
+	};
+
+	/// <summary>
+	/// promise of shared task without result.
+	/// </summary>
+	template <>
+	class shared_task_promise<void> : public shared_task_promise_base
+	{
+	public:
+		shared_task<void> get_return_object();
+
+		void return_void()
+		{
+		}
+
+		void Result() const
+		{
+			RethrowIfFailed();
+		}
+	};
+
+	/// <summary>
+	/// non thread safe coroutine task, whose frame is allocated together with its counter.
+	/// the frame lives while shared pointers to its promise are alive, and it can be observed by weak pointers.
+	/// the last owner must not be released while the coroutine is running.
+	/// </summary>
+	template <class T = void>
+	class shared_task
+	{
+	public:
+		using promise_type = shared_task_promise<T>;
+
+		/// <summary>
+		/// constructor with nullptr.
+		/// </summary>
+		shared_task()
+		{
+		}
+
+		/// <summary>
+		/// constructor with owner of a frame.
+		/// </summary>
+		explicit shared_task(shared_ptr<promise_type> frame)
+			: frame(std::move(frame))
+		{
+		}
+
+		/// <summary>
+		/// check if task is not null.
+		/// </summary>
+		explicit operator bool() const
+		{
+			return frame.get();
+		}
+
+		/// <summary>
+		/// check if coroutine is finished.
+		/// </summary>
+		bool done() const
+		{
+			return frame.get() && std::coroutine_handle<promise_type>::from_promise(*frame.get()).done();
+		}
+
+		/// <summary>
+		/// get result of finished coroutine, or rethrow its exception.
+		/// </summary>
+		decltype(auto) result() const
+		{
+			assert(done());
+			return frame.get()->Result();
+		}
+
+		/// <summary>
+		/// get owner of frame.
+		/// </summary>
+		shared_ptr<promise_type> share() const
+		{
+			return frame;
+		}
+
+		/// <summary>
+		/// get observer of frame.
+		/// </summary>
+		weak_ptr<promise_type> observe() const
+		{
+			auto owner = frame;
+			return weak_ptr<promise_type>(owner);
+		}
+
+		/// <summary>
+		/// get reference count of frame.
+		/// </summary>
+		long use_count() const
+		{
+			return frame.use_count();
+		}
+
+		/// <summary>
+		/// awaiter resumed when task is finished. it keeps the frame while waiting.
+		/// </summary>
+		struct Awaiter
+		{
+			shared_ptr<promise_type> frame;
+
+			bool await_ready() const
+			{
+				return std::coroutine_handle<promise_type>::from_promise(*frame.get()).done();
+			}
+
+			void await_suspend(std::coroutine_handle<> waiter)
+			{
+				frame.get()->Await(waiter);
+			}
+
+			decltype(auto) await_resume() const
+			{
+				return frame.get()->Result();
+			}
+		};
+
+		Awaiter operator co_await() const
+		{
+			assert(frame.get());
+			return Awaiter{ frame };
+		}
+
+	private:
+		/// <summary>
+		/// owner of frame.
+		/// </summary>
+		shared_ptr<promise_type> frame;
+
+	};
+
+	inline shared_task<void> shared_task_promise<void>::get_return_object()
+	{
+		return shared_task<void>(Adopt(this));
+	}
+#endif
+
+	/// <summary>
+	/// deleter of std::shared_ptr bridged from shared pointer, holding one owner of it.
+	/// </summary>
+	template <class T0, class Dt, class Policy>
+	struct std_bridge_owner
+	{
+		shared_ptr<T0, Dt, Policy> owner;
+
+		void operator()(typename shared_ptr<T0, Dt, Policy>::T*)
+		{
+			owner.reset();
+		}
+	};
+
+	/// <summary>
+	/// deleter of shared pointer bridged from std::shared_ptr, which is pinned in the block of its counter.
+	/// </summary>
+	template <class T0>
+	struct std_bridge_pin
+	{
+		std::shared_ptr<T0>* pinned;
+
+		void operator()(void*) const
+		{
+			pinned->~shared_ptr();
+		}
+	};
+
+	/// <summary>
+	/// get std::shared_ptr sharing an object of shared pointer. std control block holds one owner for its lifetime.
+	/// a pointer bridged from std::shared_ptr gets the original back without allocation.
+	/// </summary>
+	template <class T0, class Dt, class Policy>
+	std::shared_ptr<T0> to_std(const shared_ptr<T0, Dt, Policy>& target)
+	{
+		if (!target.get())
+			return std::shared_ptr<T0>();
+
+		if constexpr (std::is_same<Dt, std::function<void(void*)>>::value)
+		{
+			auto pin = target.get_deleter().template target<std_bridge_pin<T0>>();
+			if (pin && pin->pinned->get() == target.get())
+				return *pin->pinned;
+		}
+
+		return std::shared_ptr<T0>(target.get(), std_bridge_owner<T0, Dt, Policy>{ target });
+	}
+
+	/// <summary>
+	/// get shared pointer sharing an object of std::shared_ptr. its counter block pins one std owner for its lifetime.
+	/// a pointer bridged by to_std gets the original back without allocation.
+	/// </summary>
+	template <class T0>
+	shared_ptr<T0> from_std(const std::shared_ptr<T0>& target)
+	{
+		if (!target)
+			return shared_ptr<T0>();
+
+		auto bridge = std::get_deleter<std_bridge_owner<T0, std::function<void(void*)>, counter_policy<>>>(target);
+		if (bridge && bridge->owner.get() == target.get())
+			return bridge->owner;
+
+		void* storage;
+		auto ref_count = AccesserForFactory::CreateWithStorage<counter_policy<>>(sizeof(std::shared_ptr<T0>), alignof(std::shared_ptr<T0>), storage);
+		auto pinned = new (storage) std::shared_ptr<T0>(target);
+
+		return AccesserForFactory::Adopt<T0, std::function<void(void*)>, counter_policy<>>(target.get(), ref_count, std_bridge_pin<T0>{ pinned });
+	}
+
+	/// <summary>
+	/// lock weak pointer, and get std::shared_ptr sharing its object, or null if expired.
+	/// weak pointers are not bridged as they are, since the bridge lives only while it is owned.
+	/// </summary>
+	template <class T0, class Policy>
+	std::shared_ptr<T0> lock_to_std(weak_ptr<T0, Policy>& target)
+	{
+		return to_std(target.lock());
+	}
+
+	/// <summary>
+	/// lock std::weak_ptr, and get shared pointer sharing its object, or null if expired.
+	/// </summary>
+	template <class T0>
+	shared_ptr<T0> lock_from_std(const std::weak_ptr<T0>& target)
+	{
+		return from_std(target.lock());
+	}
+
+	/// <summary>
+	/// non thread safe scope deferring count updates of shared pointers with deferred counting policy.
+	/// while a scope is active on the thread, copies and releases of the shared pointers record net deltas per counter,
+	/// and the deltas are applied at the end of the scope, disposing resources which have no owner then.
+	/// weak pointers see releases in a scope after its end. nested scope passes its deltas to the outer scope.
+	/// </summary>
+	template <class Policy = deferred_counter_policy>
+	class deferred_rc_scope
+	{
+		static_assert(Policy::deferred_counting, "deferred_rc_scope needs counter policy with deferred counting.");
+
+	public:
+		using RefCounter = BasicSharedPtrRefCounter<Policy>;
+
+		/// <summary>
+		/// constructor, activating this scope on the thread.
+		/// </summary>
+		deferred_rc_scope()
+			: outer(current)
+		{
+			current = this;
+		}
+
+		deferred_rc_scope(const deferred_rc_scope&) = delete;
+		deferred_rc_scope& operator=(const deferred_rc_scope&) = delete;
+
+		/// <summary>
+		/// destructor, applying deltas to counters or to the outer scope.
+		/// </summary>
+		~deferred_rc_scope()
+		{
+			assert(current == this);
+			current = outer;
+			if (outer)
+				MergeInto(*outer);
+			else
+				Apply();
+		}
+
+		/// <summary>
+		/// count counters having deltas.
+		/// </summary>
+		size_t size() const
+		{
+			return entries.size();
+		}
+
+		template <class T, class U, class P> friend class shared_ptr;
+
+	private:
+		/// <summary>
+		/// net delta of a counter, and how to dispose its resource.
+		/// </summary>
+		struct Entry
+		{
+			RefCounter* ref_count;
+			std::ptrdiff_t delta;
+			void* raw;
+			std::function<void(void*)> deleter;
+			bool expired = false;
+		};
+
+		/// <summary>
+		/// counters are searched linearly up to this, and by index beyond.
+		/// </summary>
+		static constexpr size_t linear_limit = 16;
+
+		/// <summary>
+		/// record an owner added.
+		/// </summary>
+		void Acquire(RefCounter* ref_count)
+		{
+			++Find(ref_count).delta;
+		}
+
+		/// <summary>
+		/// record an owner released, keeping a copy of its deleter at first time.
+		/// </summary>
+		template <class Dt>
+		void Release(RefCounter* ref_count, void* raw, const Dt& deleter)
+		{
+			Entry& entry = Find(ref_count);
+			--entry.delta;
+			if (!entry.deleter)
+			{
+				entry.raw = raw;
+				entry.deleter = deleter;
+			}
+		}
+
+		/// <summary>
+		/// get delta recorded for counter.
+		/// </summary>
+		std::ptrdiff_t Pending(const RefCounter* ref_count) const
+		{
+			if (index.empty())
+			{
+				for (auto& entry : entries)
+				{
+					if (entry.ref_count == ref_count)
+						return entry.delta;
+				}
+				return 0;
+			}
+
+			auto found = index.find(const_cast<RefCounter*>(ref_count));
+			return found == index.end() ? 0 : entries[found->second].delta;
+		}
+
+		/// <summary>
+		/// find or add entry of counter.
+		/// </summary>
+		Entry& Find(RefCounter* ref_count)
+		{
+			if (index.empty())
+			{
+				for (auto& entry : entries)
+				{
+					if (entry.ref_count == ref_count)
+						return entry;
+				}
+				if (entries.size() < linear_limit)
+				{
+					entries.push_back(Entry{ ref_count, 0, nullptr, nullptr });
+					return entries.back();
+				}
+
+				for (size_t i = 0; i < entries.size(); ++i)
+					index.emplace(entries[i].ref_count, i);
+			}
+
+			auto inserted = index.emplace(ref_count, entries.size());
+			if (inserted.second)
+				entries.push_back(Entry{ ref_count, 0, nullptr, nullptr });
+
+			return entries[inserted.first->second];
+		}
+
+		/// <summary>
+		/// pass deltas to outer scope.
+		/// </summary>
+		void MergeInto(deferred_rc_scope& scope)
+		{
+			for (auto& entry : entries)
+			{
+				Entry& merged = scope.Find(entry.ref_count);
+				merged.delta += entry.delta;
+				if (!merged.deleter && entry.deleter)
+				{
+					merged.raw = entry.raw;
+					merged.deleter = std::move(entry.deleter);
+				}
+			}
+		}
+
+		/// <summary>
+		/// apply deltas to counters, and then dispose resources without owner.
+		/// all deltas are applied before disposing, so that disposing never sees a count missing its additions.
+		/// counters losing owners are pinned by an observer until all are disposed,
+		/// because disposing a resource may release the last weak pointer to a counter disposed later.
+		/// </summary>
+		void Apply()
+		{
+			for (auto& entry : entries)
+			{
+				if (entry.delta < 0)
+					Pin(entry.ref_count);
+			}
+
+			for (auto& entry : entries)
+			{
+				if (entry.delta > 0)
+					entry.ref_count->IncreaseOwner(static_cast<typename RefCounter::count_type>(entry.delta));
+				else if (entry.delta < 0)
+					entry.expired = entry.ref_count->DecreaseOwner(static_cast<typename RefCounter::count_type>(-entry.delta)) == 0;
+			}
+
+			for (auto& entry : entries)
+			{
+				if (!entry.expired)
+					continue;
+
+				assert(entry.deleter);
+				SMART_POINTER_NTS_LOG("release resource: " + std::to_string((unsigned long)entry.raw) + " at the end of deferred scope");
+				entry.ref_count->DisposeResource([&entry]() { entry.deleter(entry.raw); });
+			}
+
+			for (auto& entry : entries)
+			{
+				if (entry.delta < 0)
+					Unpin(entry.ref_count);
+			}
+		}
+
+		/// <summary>
+		/// keep counter while applying deltas.
+		/// </summary>
+		static void Pin(RefCounter* ref_count)
+		{
+			if constexpr (Policy::weak_support)
+				ref_count->IncreaseObserver();
+		}
+
+		/// <summary>
+		/// release counter kept while applying deltas, and delete it if its resource has been disposed and it has no observer.
+		/// </summary>
+		static void Unpin(RefCounter* ref_count)
+		{
+			if constexpr (Policy::weak_support)
+			{
+				if (ref_count->DecreaseObserver() == 0 && ref_count->CountOwners() == 0)
+					RefCounter::Destroy(ref_count);
+			}
+		}
+
+		/// <summary>
+		/// active scope on this thread.
+		/// </summary>
+		static inline thread_local deferred_rc_scope* current = nullptr;
+
+		/// <summary>
+		/// scope which was active when this scope began.
+		/// </summary>
+		deferred_rc_scope* outer;
+
+		/// <summary>
+		/// deltas in order of first update.
+		/// </summary>
+		std::vector<Entry> entries;
+
+		/// <summary>
+		/// index of entries, built when entries exceed linear limit.
+		/// </summary>
+		std::unordered_map<RefCounter*, size_t> index;
+
+	};
+}
+
+/// <summary>
+/// hash class implementation for nts shared ptr.
+/// </summary>
+template <class T>
+struct std::hash<smart_pointer_nts::unique_ptr<T>>
+{
+	std::size_t operator()(
+		const smart_pointer_nts::unique_ptr<T>& target) const noexcept
+	{
+		return std::hash<T*>()(target.get());
+	}
+};
+
+/// <summary>
+/// equal_to class implementation for nts shared ptr.
+/// </summary>
 template <class T>
-struct std::equal_to<smart_pointer_nts::shared_ptr<T>>
+struct std::equal_to<smart_pointer_nts::unique_ptr<T>>
+{
+	constexpr bool operator ()(
+		smart_pointer_nts::unique_ptr<T>& target1,
+		smart_pointer_nts::unique_ptr<T>& target2) const
+	{
+		return target1.get() == target2.get();
+	}
+};
+
+/// <summary>
+/// hash class implementation for nts shared ptr.
+/// </summary>
+template <class T, class Dt, class P>
+struct std::hash<smart_pointer_nts::shared_ptr<T, Dt, P>>
+{
+	std::size_t operator()(
+		const smart_pointer_nts::shared_ptr<T, Dt, P>& target) const noexcept
+	{
+		return std::hash<T*>()(target.get());
+	}
+};
+
+/// <summary>
+/// equal_to class implementation for nts shared ptr.
+/// </summary>
+template <class T, class Dt, class P>
+struct std::equal_to<smart_pointer_nts::shared_ptr<T, Dt, P>>
 {
 	constexpr bool operator ()(
-		const smart_pointer_nts::shared_ptr<T>& target1,
-		const smart_pointer_nts::shared_ptr<T>& target2) const
+		const smart_pointer_nts::shared_ptr<T, Dt, P>& target1,
+		const smart_pointer_nts::shared_ptr<T, Dt, P>& target2) const
 	{
 		return target1.get() == target2.get();
 	}
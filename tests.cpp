@@ -178,6 +178,1160 @@ void TestEtcetra()
 	assert(set0.size() == 3);
 }
 
+void TestSharedPtrArray()
+{
+	std::cout << "TestSharedPtrArray.." << std::endl;
+
+	shared_ptr<test> sp1(new test(1, 2));
+	shared_ptr<test> sp2(new test(3, 4));
+
+	// bulk copy
+	shared_ptr_array<test> ary1;
+	for (int i = 0; i < 4; ++i)
+		ary1.push_back(sp1);
+	ary1.push_back(shared_ptr<test>());
+	ary1.push_back(shared_ptr<test>(sp2));
+	assert(ary1.size() == 6);
+	assert(sp1.use_count() == 5);
+
+	auto ary2 = ary1;
+	assert(sp1.use_count() == 9);
+	assert(sp2.use_count() == 3);
+	assert(ary2[0].get() == sp1.get());
+	assert(ary2.get(5)->y == 4);
+
+	// slice and release
+	auto ary3 = ary2.slice(2, 3);
+	assert(ary3.size() == 3);
+	assert(sp1.use_count() == 11);
+	ary2.erase(0, 4);
+	assert(sp1.use_count() == 7);
+	ary2.clear();
+	assert(sp2.use_count() == 2);
+
+	// null and expiry scans
+	assert(ary1.count_null() == 1);
+	assert(ary1.count_expired() == 0);
+	sp1.reset();
+	assert(ary3.use_count(0) == 6);
+	assert(ary1.count_expired() == 0);
+	ary3.clear();
+	assert(ary1.count_expired() == 4);
+	ary1.remove_expired();
+	assert(ary1.size() == 1);
+	assert(ary1.use_count(0) == 2);
+
+	// interleaved counters and custom deleter
+	int deleted = 0;
+	auto deleter = [&deleted](void* obj) { delete static_cast<test*>(obj); ++deleted; };
+	shared_ptr_array<test> ary4;
+	{
+		shared_ptr<test> sp3(new test(5, 6), deleter);
+		shared_ptr<test> sp4(new test(7, 8), deleter);
+		for (int i = 0; i < 3; ++i)
+		{
+			ary4.push_back(sp3);
+			ary4.push_back(sp4);
+			ary4.push_back(sp2);
+		}
+		assert(sp3.use_count() == 4);
+		ary4.erase(0, 2);
+		assert(sp3.use_count() == 3);
+		assert(ary4[0].get() == sp2.get());
+	}
+	assert(deleted == 0);
+	assert(ary4.count_expired() == 4);
+	assert(sp2.use_count() == 5);
+	ary4.remove_expired();
+	assert(deleted == 2);
+	assert(ary4.size() == 3);
+	assert(ary4.count_expired() == 0);
+	assert(ary4[2]->y == 4);
+	ary4.clear();
+	assert(sp2.use_count() == 2);
+}
+
+void TestCounterPolicy()
+{
+	std::cout << "TestCounterPolicy.." << std::endl;
+
+	using small_policy = counter_policy<16, false>;
+	using checked_policy = counter_policy<8, true, true>;
+	static_assert(sizeof(RefCountStorage<small_policy>) * 4 == sizeof(RefCountStorage<counter_policy<>>), "");
+
+	// counter without weak support
+	{
+		shared_ptr<test, std::function<void(void*)>, small_policy> sp1(new test(1, 2));
+		auto sp2 = sp1;
+		assert(sp1.use_count() == 2);
+		sp1.reset();
+		assert(sp2.use_count() == 1);
+		assert(sp2->y == 2);
+	}
+
+	// overflow check
+	{
+		shared_ptr<test, std::function<void(void*)>, checked_policy> sp1(new test(3, 4));
+		weak_ptr<test, checked_policy> wp1 = sp1;
+		std::vector<shared_ptr<test, std::function<void(void*)>, checked_policy>> copies;
+		copies.reserve(253);
+		for (int i = 0; i < 253; ++i)
+			copies.push_back(sp1);
+		assert(sp1.use_count() == 254);
+
+		bool thrown = false;
+		try
+		{
+			auto overflow = sp1;
+		}
+		catch (std::overflow_error&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(sp1.use_count() == 254);
+		assert(sp1->y == 4);
+
+		copies.clear();
+		assert(wp1.lock().use_count() == 2);
+	}
+}
+
+struct compact_node
+{
+	int depth;
+	compact_shared<compact_node> child;
+
+	compact_node(int depth) : depth(depth)
+	{
+		if (depth < 0)
+			throw std::invalid_argument("negative depth");
+		if (depth > 0)
+			child = make_compact_shared<compact_node>(depth - 1);
+	}
+};
+
+void TestCompactShared()
+{
+	std::cout << "TestCompactShared.." << std::endl;
+
+	static_assert(sizeof(compact_shared<test>) == 4, "");
+
+	auto cs1 = make_compact_shared<test>(1, 2);
+	auto cs2 = cs1;
+	assert(cs1.use_count() == 2);
+	assert(cs2->y == 2);
+	assert(cs1 == cs2);
+
+	// to and from shared ptr
+	{
+		auto sp1 = cs1.to_shared();
+		assert(cs1.use_count() == 3);
+		assert(sp1.get() == cs1.get());
+
+		auto cs3 = compact_shared<test>::from_shared(std::move(sp1));
+		assert(cs3 == cs1);
+		assert(cs1.use_count() == 3);
+
+		auto cs4 = compact_shared<test>::from_shared(shared_ptr<test>(new test(3, 4)));
+		assert(cs4->x == 3);
+		assert(cs4.use_count() == 1);
+
+		// observed object is not moved
+		shared_ptr<test> sp2(new test(5, 6));
+		weak_ptr<test> wp2 = sp2;
+		auto cs5 = compact_shared<test>::from_shared(std::move(sp2));
+		assert(!cs5);
+		assert(!wp2.expired());
+	}
+	assert(cs1.use_count() == 2);
+
+	// slots are reused
+	auto index = cs1.slab_index();
+	cs1.reset();
+	cs2.reset();
+	assert(cs2.get() == nullptr);
+	auto cs5 = make_compact_shared<test>(5, 6);
+	assert(cs5.slab_index() == index);
+
+	// constructor making another object in the same slab
+	auto root = make_compact_shared<compact_node>(2);
+	assert(root->child.slab_index() != root.slab_index());
+	assert(root->child->child.slab_index() != root->child.slab_index());
+	assert(root->depth == 2 && root->child->depth == 1 && root->child->child->depth == 0);
+	assert(compact_slab<compact_node>::instance().size() == 3);
+
+	// slot is given back when constructor throws
+	bool thrown = false;
+	try
+	{
+		make_compact_shared<compact_node>(-1);
+	}
+	catch (std::invalid_argument&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+	assert(compact_slab<compact_node>::instance().size() == 3);
+}
+
+struct slot_node
+{
+	int depth;
+	shared_ptr<slot_node> child;
+
+	slot_node(slot_pool<slot_node>& pool, int depth) : depth(depth)
+	{
+		if (depth < 0)
+			throw std::invalid_argument("negative depth");
+		if (depth > 0)
+			child = pool.make(pool, depth - 1);
+	}
+};
+
+void TestSlotHandle()
+{
+	std::cout << "TestSlotHandle.." << std::endl;
+
+	static_assert(sizeof(slot_handle<test>) == 8, "");
+
+	slot_pool<test> pool;
+	slot_handle<test> handle;
+	{
+		auto sp1 = pool.make(1, 2);
+		handle = pool.handle(sp1);
+		assert(pool.valid(handle));
+		assert(pool.get(handle)->y == 2);
+
+		// promotion
+		auto sp2 = pool.lock(handle);
+		assert(sp2.get() == sp1.get());
+		assert(sp1.use_count() == 2);
+
+		// weak pointers still work with pool objects
+		weak_ptr<test> wp1 = sp1;
+		auto sp4 = wp1.lock();
+		sp1.reset();
+		sp2.reset();
+		assert(!wp1.expired());
+		sp4.reset();
+		assert(wp1.expired());
+		assert(pool.size() == 0);
+	}
+	assert(!pool.valid(handle));
+	assert(pool.get(handle) == nullptr);
+	assert((bool)pool.lock(handle) == false);
+
+	// reused slot does not revive old handle
+	auto sp3 = pool.make(3, 4);
+	assert(pool.handle(sp3).index == handle.index);
+	assert(!pool.valid(handle));
+	assert(pool.size() == 1);
+	assert(!pool.handle(shared_ptr<test>(new test)));
+
+	// constructor making another object in the same pool
+	slot_pool<slot_node> nodes;
+	{
+		auto root = nodes.make(nodes, 2);
+		assert(nodes.handle(root).index != nodes.handle(root->child).index);
+		assert(root->depth == 2 && root->child->depth == 1 && root->child->child->depth == 0);
+		assert(nodes.size() == 3);
+
+		bool thrown = false;
+		try
+		{
+			nodes.make(nodes, -1);
+		}
+		catch (std::invalid_argument&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(nodes.size() == 3);
+	}
+	assert(nodes.size() == 0);
+}
+
+void TestImmortalSharedPointer()
+{
+	std::cout << "TestImmortalSharedPointer.." << std::endl;
+
+	static test sentinel1(1, 2);
+	static test sentinel2(3, 4);
+
+	auto sp1 = make_immortal_shared(sentinel1);
+	auto count = sp1.use_count();
+	{
+		// copies never write counter
+		auto sp2 = sp1;
+		shared_ptr<test> sp3(new test);
+		sp3 = sp2;
+		weak_ptr<test> wp1 = sp3;
+		assert(wp1.lock()->y == 2);
+		assert(sp1.use_count() == count);
+	}
+	assert(sp1.use_count() == count);
+
+	// immortal objects share counter, but not resource
+	auto sp4 = make_immortal_shared(sentinel2);
+	sp4 = sp1;
+	assert(sp4.get() == &sentinel1);
+
+	// never deleted
+	sp1.reset();
+	sp4.reset();
+	assert(sentinel1.y == 2);
+}
+
+struct cycle_node
+{
+	shared_ptr<cycle_node> next;
+	weak_ptr<cycle_node> prev;
+	int& alive;
+
+	cycle_node(int& alive) : alive(alive) { ++alive; }
+	~cycle_node() { --alive; }
+
+	void trace(cycle_tracer& tracer)
+	{
+		tracer(next);
+		tracer(prev);
+	}
+};
+
+void TestCycleCollector()
+{
+	std::cout << "TestCycleCollector.." << std::endl;
+
+	int alive = 0;
+	auto makeRing = [&alive](int length)
+	{
+		shared_ptr<cycle_node> first(new cycle_node(alive));
+		auto last = first;
+		for (int i = 1; i < length; ++i)
+		{
+			shared_ptr<cycle_node> node(new cycle_node(alive));
+			node->prev = last;
+			last->next = node;
+			last = node;
+		}
+		last->next = first;
+		first->prev = last;
+		return first;
+	};
+
+	// garbage ring
+	makeRing(3);
+	assert(alive == 3);
+	assert(cycle_collector::instance().candidates() > 0);
+	assert(collect_cycles() == 3);
+	assert(alive == 0);
+	assert(cycle_collector::instance().candidates() == 0);
+
+	// ring referenced from outside is kept
+	{
+		auto ring = makeRing(4);
+		weak_ptr<cycle_node> observer = ring;
+		assert(collect_cycles() == 0);
+		assert(alive == 4);
+		assert(ring->next->next->next->next.get() == ring.get());
+		ring.reset();
+		assert(!observer.expired());
+
+		// collect within time budget
+		makeRing(2);
+		collect_cycles(std::chrono::nanoseconds(0));
+		while (cycle_collector::instance().candidates())
+			collect_cycles(std::chrono::nanoseconds(0));
+		assert(alive == 0);
+		assert(observer.expired());
+	}
+}
+
+void TestObjectPool()
+{
+	std::cout << "TestObjectPool.." << std::endl;
+
+	// recycle storage
+	{
+		object_pool<test> pool(2);
+		{
+			auto sp1 = make_pooled(pool, 1, 2);
+			auto sp2 = make_pooled(pool, 3, 4);
+			auto up3 = make_pooled_unique(pool, 5, 6);
+			assert(up3->y == 6);
+			assert(sp2->y == 4);
+		}
+		assert(pool.statistics().misses == 3);
+		assert(pool.statistics().recycled == 2);
+		assert(pool.statistics().discarded == 1);
+		assert(pool.size() == 2);
+
+		auto sp4 = make_pooled(pool, 7, 8);
+		assert(pool.statistics().hits == 1);
+		assert(sp4->y == 8);
+
+		// locked owner also returns an object to pool
+		weak_ptr<test> wp4 = sp4;
+		auto sp5 = wp4.lock();
+		sp4.reset();
+		wp4.reset();
+		sp5.reset();
+		assert(pool.size() == 2);
+
+		// observed object is not recycled, because its counter outlives it
+		auto sp6 = make_pooled(pool, 9, 10);
+		weak_ptr<test> wp6 = sp6;
+		sp6.reset();
+		assert(wp6.expired());
+		assert(pool.size() == 1);
+		assert(pool.statistics().discarded == 2);
+	}
+
+	// reset in place
+	{
+		object_pool<test> pool(4, pool_recycle::reset, [](test& obj) { obj.x = 0; });
+		auto sp1 = make_pooled(pool, 1, 2);
+		auto raw = sp1.get();
+		sp1.reset();
+		auto sp2 = make_pooled(pool);
+		assert(sp2.get() == raw);
+		assert(sp2->x == 0);
+		assert(sp2->y == 2);
+	}
+}
+
+void TestCowPointer()
+{
+	std::cout << "TestCowPointer.." << std::endl;
+
+	// single allocation shared ptr
+	weak_ptr<test> wp1;
+	{
+		auto sp1 = make_shared<test>(1, 2);
+		wp1 = sp1;
+		assert(sp1.use_count() == 1);
+		assert(wp1.lock()->y == 2);
+	}
+	assert(wp1.expired());
+
+	struct alignas(64) aligned_test
+	{
+		int x = 7;
+	};
+	auto sp2 = make_shared<aligned_test>();
+	assert(reinterpret_cast<std::uintptr_t>(sp2.get()) % 64 == 0);
+	assert(sp2->x == 7);
+
+	// copies share a value until written
+	auto cp1 = make_cow<test>(3, 4);
+	auto cp2 = cp1;
+	assert(cp1.use_count() == 2);
+	assert(cp2->y == 4);
+	assert(cp1.get() == cp2.get());
+
+	cp2.write().y = 5;
+	assert(cp1.get() != cp2.get());
+	assert(cp1->y == 4);
+	assert(cp2->y == 5);
+	assert(cp1.unique() && cp2.unique());
+
+	// unique value is written in place
+	auto raw = cp2.get();
+	cp2.write().x = 6;
+	assert(cp2.get() == raw);
+
+	auto cp3 = cp2;
+	cp3.unshare();
+	assert(cp3.get() != raw);
+	assert(cp3->x == 6);
+}
+
+struct colliding_hash
+{
+	size_t operator()(int key) const { return key % 2; }
+};
+
+void TestPersistentContainers()
+{
+	std::cout << "TestPersistentContainers.." << std::endl;
+
+	// vector
+	persistent_vector<int> vec1;
+	for (int i = 0; i < 2000; ++i)
+		vec1.push_back(i);
+	auto vec2 = vec1;
+	vec2.set(500, -1);
+	vec2.set(1999, -2);
+	vec2.push_back(2000);
+	assert(vec1.size() == 2000 && vec2.size() == 2001);
+	assert(vec1[500] == 500 && vec2[500] == -1);
+	assert(vec1[1999] == 1999 && vec2[1999] == -2);
+	while (vec2.size() > 1)
+		vec2.pop_back();
+	assert(vec2[0] == 0);
+	for (int i = 0; i < 2000; ++i)
+		assert(vec1[i] == i);
+
+	// map
+	persistent_map<int, int> map1;
+	for (int i = 0; i < 2000; ++i)
+		map1.set(i, i * 2);
+	auto map2 = map1;
+	map2.set(10, -1);
+	assert(map2.erase(20));
+	assert(!map2.erase(20));
+	assert(map1.size() == 2000 && map2.size() == 1999);
+	assert(*map1.find(10) == 20 && *map2.find(10) == -1);
+	assert(map1.contains(20) && !map2.contains(20));
+	size_t sum = 0;
+	map1.for_each([&sum](int, int value) { sum += value; });
+	assert(sum == 1999 * 2000);
+
+	// map with colliding hash
+	persistent_map<int, int, colliding_hash> map3;
+	for (int i = 0; i < 10; ++i)
+		map3.set(i, i);
+	auto map4 = map3;
+	for (int i = 0; i < 10; i += 2)
+		map4.erase(i);
+	assert(map3.size() == 10 && map4.size() == 5);
+	assert(*map3.find(4) == 4 && !map4.find(4) && *map4.find(5) == 5);
+}
+
+struct grouped_object
+{
+	int& alive;
+
+	grouped_object(int& alive) : alive(alive) { ++alive; }
+	~grouped_object() { --alive; }
+};
+
+void TestSharedGroup()
+{
+	std::cout << "TestSharedGroup.." << std::endl;
+
+	int alive = 0;
+	shared_ptr<grouped_object> member;
+	weak_ptr<test> observer;
+	{
+		shared_group group(256);
+		for (int i = 0; i < 100; ++i)
+			group.make<grouped_object>(alive);
+		auto sp1 = group.make<test>(1, 2);
+		observer = sp1;
+		member = group.make<grouped_object>(alive);
+		assert(group.size() == 102);
+		assert(alive == 101);
+		assert(group.use_count() == 3);
+		assert(sp1.use_count() == 3);
+
+		// moved-from group is empty
+		shared_group moved = std::move(group);
+		assert(group.size() == 0);
+		assert(group.use_count() == 0);
+		assert(moved.size() == 102);
+	}
+
+	// members keep the whole group
+	assert(alive == 101);
+	assert(observer.lock()->y == 2);
+	member.reset();
+	assert(alive == 0);
+	assert(observer.expired());
+}
+
+struct strategy
+{
+	virtual ~strategy() {}
+	virtual int apply(int value) = 0;
+};
+
+struct add_strategy : strategy
+{
+	int amount;
+	int& alive;
+
+	add_strategy(int amount, int& alive) : amount(amount), alive(alive) { ++alive; }
+	add_strategy(add_strategy&& target) noexcept : amount(target.amount), alive(target.alive) { ++alive; }
+	~add_strategy() { --alive; }
+	int apply(int value) override { return value + amount; }
+};
+
+struct table_strategy : strategy
+{
+	int table[64] = {};
+	int& alive;
+
+	table_strategy(int& alive) : alive(alive) { ++alive; table[3] = 42; }
+	~table_strategy() { --alive; }
+	int apply(int value) override { return table[value]; }
+};
+
+void TestInlinePointer()
+{
+	std::cout << "TestInlinePointer.." << std::endl;
+
+	int alive = 0;
+	{
+		auto small = make_inline<strategy, add_strategy>(2, alive);
+		assert(small.is_inline());
+		assert(small->apply(1) == 3);
+
+		auto large = make_inline<strategy, table_strategy>(alive);
+		assert(!large.is_inline());
+		assert(large->apply(3) == 42);
+		assert(alive == 2);
+
+		// moving inline object relocates it
+		inline_ptr<strategy> moved(std::move(small));
+		assert(!small);
+		assert(moved.is_inline() && moved->apply(1) == 3);
+		assert(alive == 2);
+
+		// moving heap object steals pointer
+		strategy* raw = large.get();
+		moved = std::move(large);
+		assert(!large && moved.get() == raw);
+		assert(alive == 1);
+
+		moved.reset(new add_strategy(5, alive));
+		assert(!moved.is_inline() && moved->apply(1) == 6);
+		assert(alive == 1);
+		moved.emplace<add_strategy>(7, alive);
+		assert(moved.is_inline() && (*moved).apply(1) == 8);
+	}
+	assert(alive == 0);
+}
+
+struct mapped_node
+{
+	int value;
+	offset_shared_ptr<mapped_node> next;
+	offset_unique_ptr<test> payload;
+
+	mapped_node(int value) : value(value) {}
+};
+
+void TestOffsetPointer()
+{
+	std::cout << "TestOffsetPointer.." << std::endl;
+
+	const size_t size = 1 << 16;
+	std::vector<std::max_align_t> mapping1(size / sizeof(std::max_align_t));
+	std::vector<std::max_align_t> mapping2(size / sizeof(std::max_align_t));
+	{
+		mapped_segment segment(mapping1.data(), size);
+		assert(!segment.attached());
+
+		offset_shared_ptr<mapped_node> head;
+		for (int i = 0; i < 10; ++i)
+		{
+			auto node = make_offset_shared<mapped_node>(segment, i);
+			node->next = head;
+			node->payload = make_offset_unique<test>(segment, i, i * 2);
+			head = std::move(node);
+		}
+		segment.set_root(head);
+		assert(head.use_count() == 2);
+	}
+
+	// map the same bytes at another address
+	std::copy(mapping1.begin(), mapping1.end(), mapping2.begin());
+	std::fill(mapping1.begin(), mapping1.end(), std::max_align_t());
+	{
+		mapped_segment segment(mapping2.data(), size);
+		assert(segment.attached());
+
+		auto head = segment.root<mapped_node>();
+		assert(head.use_count() == 2);
+		int expected = 9;
+		for (auto node = head.get(); node; node = node->next.get(), --expected)
+		{
+			assert(node->value == expected);
+			assert(node->payload->y == expected * 2);
+		}
+		assert(expected == -1);
+
+		// released blocks are merged and reused from the lowest one, which is the first node made
+		mapped_node* tail = head.get();
+		while (tail->next)
+			tail = tail->next.get();
+		segment.set_root(offset_shared_ptr<mapped_node>());
+		head->next->next.reset();
+		auto reused = make_offset_shared<mapped_node>(segment, 100);
+		assert(reused.get() == tail);
+	}
+
+	// adjacent free blocks are merged, and the last one is returned to top
+	{
+		mapped_segment segment(mapping1.data(), size);
+		assert(!segment.attached());
+
+		void* first = segment.allocate(64);
+		void* second = segment.allocate(64);
+		void* third = segment.allocate(64);
+		void* last = segment.allocate(64);
+		mapped_segment::deallocate(first);
+		mapped_segment::deallocate(third);
+		mapped_segment::deallocate(second);
+		void* merged = segment.allocate(192);
+		assert(merged == first);
+
+		mapped_segment::deallocate(merged);
+		mapped_segment::deallocate(last);
+		assert(segment.allocate(256) == first);
+	}
+
+	// pointer to its own address is not null
+	{
+		struct self_node
+		{
+			offset_ptr<self_node> self;
+		};
+
+		self_node node;
+		node.self = &node;
+		assert(node.self);
+		assert(node.self.get() == &node);
+		node.self = nullptr;
+		assert(!node.self);
+	}
+}
+
+struct graph_node
+{
+	std::string name;
+	std::vector<int> values;
+	shared_ptr<graph_node> left;
+	shared_ptr<graph_node> right;
+	weak_ptr<graph_node> parent;
+
+	template <class Archive>
+	void serialize(Archive& archive)
+	{
+		archive(name);
+		archive(values);
+		archive(left);
+		archive(right);
+		archive(parent);
+	}
+};
+
+void TestGraphSerialization()
+{
+	std::cout << "TestGraphSerialization.." << std::endl;
+
+	auto root = make_shared<graph_node>();
+	auto shared = make_shared<graph_node>();
+	auto unreachable = make_shared<graph_node>();
+	root->name = "root";
+	root->left = make_shared<graph_node>();
+	root->right = make_shared<graph_node>();
+	root->left->left = shared;
+	root->right->right = shared;
+	root->left->parent = root;
+	root->right->parent = unreachable;
+	shared->name = "shared";
+	shared->values = { 1, 2, 3 };
+	shared->parent = shared->right = root->left;
+
+	auto bytes = serialize_graph(root);
+	auto loaded = deserialize_graph<graph_node>(bytes);
+
+	assert(loaded->name == "root");
+	auto loaded_shared = loaded->left->left;
+	assert(loaded_shared.get() == loaded->right->right.get());
+	assert(loaded_shared.use_count() == 3);
+	assert(loaded_shared->values == std::vector<int>({ 1, 2, 3 }));
+	assert(loaded->left->parent.lock().get() == loaded.get());
+	assert(loaded->right->parent.expired());
+	assert(loaded_shared->right.get() == loaded->left.get());
+	assert(loaded_shared->parent.lock().get() == loaded->left.get());
+
+	// a graph is written as it is again
+	assert(serialize_graph(loaded) == bytes);
+
+	bool thrown = false;
+	try
+	{
+		deserialize_graph<graph_node>(bytes.data(), bytes.size() - 1);
+	}
+	catch (std::out_of_range&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+
+	// cycles are broken not to leak
+	shared->right.reset();
+	loaded_shared->right.reset();
+}
+
+void TestUniqueToShared()
+{
+	std::cout << "TestUniqueToShared.." << std::endl;
+
+	int deleted = 0;
+	auto deleter = [&deleted](void* obj) { delete static_cast<test*>(obj); ++deleted; };
+
+	unique_ptr<test> released(new test(1, 2));
+	test* raw = released.release();
+	assert(!released && raw->y == 2);
+	delete raw;
+
+	{
+		unique_ptr<test> up(new test(3, 4), deleter);
+		shared_ptr<test> sp(std::move(up));
+		assert(!up && sp->y == 4 && sp.use_count() == 1);
+
+		unique_ptr<test> up2(new test(5, 6), deleter);
+		sp = std::move(up2);
+		assert(deleted == 1 && sp->y == 6);
+	}
+	assert(deleted == 2);
+
+	{
+		auto reserved = make_reserved_unique<test>(7, 8);
+		assert(reserved->y == 8);
+		test* obj = reserved.get();
+
+		shared_ptr<test> sp(std::move(reserved));
+		assert(!reserved && sp.get() == obj && sp.use_count() == 1);
+		weak_ptr<test> wp = sp;
+		sp.reset();
+		assert(wp.expired());
+
+		// not promoted
+		auto unused = make_reserved_unique<test>(9, 10);
+		auto moved = std::move(unused);
+		sp = std::move(moved);
+		assert(sp->y == 10);
+	}
+}
+
+struct alignas(64) simd_block
+{
+	float lanes[16];
+};
+
+void TestArrayFactory()
+{
+	std::cout << "TestArrayFactory.." << std::endl;
+
+	auto zeros = make_shared<int[]>(5);
+	assert(zeros.size() == 5);
+	for (size_t i = 0; i < zeros.size(); ++i)
+		assert(zeros[i] == 0);
+
+	weak_ptr<int[]> observer = zeros;
+	auto locked = observer.lock();
+	assert(locked.size() == 5 && locked.get() == zeros.get());
+
+	auto buffer = make_unique_for_overwrite<double[]>(1000);
+	assert(buffer.size() == 1000);
+	buffer[999] = 1.0;
+	unique_ptr<double[]> moved(std::move(buffer));
+	assert(moved.size() == 1000 && buffer.size() == 0);
+	shared_ptr<double[]> published(std::move(moved));
+	assert(published.size() == 1000 && published[999] == 1.0);
+
+	auto shared_blocks = make_shared_for_overwrite<simd_block[]>(3);
+	auto unique_blocks = make_unique<simd_block[]>(3);
+	assert(reinterpret_cast<uintptr_t>(shared_blocks.get()) % 64 == 0);
+	assert(reinterpret_cast<uintptr_t>(unique_blocks.get()) % 64 == 0);
+	assert(unique_blocks[2].lanes[15] == 0.0f);
+
+	{
+		auto names = make_shared<std::string[]>(4);
+		names[3] = std::string(100, 'x');
+		auto object = make_unique<test>(1, 2);
+		assert(object->y == 2);
+	}
+
+	unique_ptr<int[]> adopted(new int[3]);
+	assert(adopted.size() == 0);
+
+	// released array is deleted by delete[]
+	auto names = make_unique<std::string[]>(2);
+	names[1] = std::string(100, 'y');
+	std::string* raw_names = names.release();
+	assert(raw_names[1].size() == 100);
+	delete[] raw_names;
+
+	// length overflowing the block with its counter
+	bool thrown = false;
+	try
+	{
+		make_shared_for_overwrite<char[]>(std::numeric_limits<size_t>::max() - 3);
+	}
+	catch (std::bad_array_new_length&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+
+#ifdef __cpp_lib_span
+	int sum = 0;
+	for (int value : zeros.span())
+		sum += value;
+	assert(sum == 0 && zeros.span().size() == 5);
+#endif
+}
+
+void TestRcBuffer()
+{
+	std::cout << "TestRcBuffer.." << std::endl;
+
+	const char message[] = "header:payload-one:payload-two";
+	rc_buffer buffer(message, sizeof(message) - 1);
+	assert(buffer.size() == 30 && buffer.use_count() == 1);
+
+	auto header = buffer.slice(0, 6);
+	auto payload = buffer.slice(7, 11);
+	assert(std::string(payload.begin(), payload.end()) == "payload-one");
+	assert(payload.data() == buffer.data() + 7);
+	assert(buffer.use_count() == 3);
+
+	bool thrown = false;
+	try
+	{
+		buffer.slice(20, 11);
+	}
+	catch (std::out_of_range&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+
+	// slices keep bytes after the whole buffer is released
+	buffer = rc_buffer();
+	assert(payload.use_count() == 2 && header[5] == 'r');
+
+	rc_buffer_chain chain;
+	chain.append(header);
+	chain.append(rc_buffer());
+	chain.append(payload);
+	assert(chain.size() == 17 && chain.buffers().size() == 2);
+
+	auto middle = chain.slice(4, 5);
+	assert(middle.buffers().size() == 2 && middle.buffers()[1].data() == payload.data());
+	auto gathered = middle.gather();
+	assert(std::string(gathered.begin(), gathered.end()) == "erpay");
+	assert(chain.slice(7, 3).gather().data() == payload.data() + 1);
+
+#ifdef __cpp_lib_span
+	std::span<const unsigned char> view = payload;
+	assert(view.size() == 11 && view[0] == 'p');
+#endif
+
+	// size overflowing the block with its counter
+	thrown = false;
+	try
+	{
+		rc_buffer huge(std::numeric_limits<size_t>::max() - 3);
+	}
+	catch (std::bad_alloc&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+struct manual_event
+{
+	std::coroutine_handle<> waiter;
+
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> handle) { waiter = handle; }
+	void await_resume() {}
+};
+
+shared_task<int> WaitAndAdd(manual_event& event, int x, int y)
+{
+	co_await event;
+	co_return x + y;
+}
+
+shared_task<> WaitTask(shared_task<int> task, int& result)
+{
+	result = co_await task;
+}
+
+shared_task<int> ThrowingTask()
+{
+	throw std::runtime_error("failed");
+	co_return 0;
+}
+
+void TestSharedTask()
+{
+	std::cout << "TestSharedTask.." << std::endl;
+
+	manual_event event;
+	int result = 0;
+	weak_ptr<shared_task_promise<int>> observer;
+	{
+		auto task = WaitAndAdd(event, 1, 2);
+		observer = task.observe();
+		assert(!task.done() && task.use_count() == 1);
+
+		auto waiting = WaitTask(task, result);
+		assert(task.use_count() == 3);
+
+		event.waiter.resume();
+		assert(task.done() && waiting.done());
+		assert(task.result() == 3 && result == 3);
+
+		// finished frame keeps its parameters until its owners are gone
+		assert(task.use_count() == 2);
+		waiting = shared_task<>();
+		assert(task.use_count() == 1);
+		assert(!observer.expired());
+	}
+	assert(observer.expired());
+
+	// frame suspended forever is destroyed by the last owner
+	{
+		manual_event never;
+		auto task = WaitAndAdd(never, 1, 2);
+		auto owner = task.share();
+		assert(owner.use_count() == 2);
+	}
+
+	auto failed = ThrowingTask();
+	assert(failed.done());
+	bool thrown = false;
+	try
+	{
+		failed.result();
+	}
+	catch (std::runtime_error&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+}
+#endif
+
+void TestStdBridge()
+{
+	std::cout << "TestStdBridge.." << std::endl;
+
+	auto nts = make_shared<test>(1, 2);
+	{
+		std::shared_ptr<test> bridged = to_std(nts);
+		auto copied = bridged;
+		assert(bridged.get() == nts.get() && bridged->y == 2);
+		assert(nts.use_count() == 2 && bridged.use_count() == 2);
+
+		// round trip gets the original
+		auto back = from_std(bridged);
+		assert(back.get() == nts.get() && nts.use_count() == 3);
+	}
+	assert(nts.use_count() == 1);
+
+	auto original = std::make_shared<test>(3, 4);
+	{
+		auto adopted = from_std(original);
+		auto copied = adopted;
+		assert(adopted.get() == original.get() && copied->y == 4);
+		assert(original.use_count() == 2 && adopted.use_count() == 2);
+
+		auto back = to_std(adopted);
+		assert(back.get() == original.get() && original.use_count() == 3);
+
+		weak_ptr<test> observer = adopted;
+		assert(lock_to_std(observer).get() == original.get());
+	}
+	assert(original.use_count() == 1);
+
+	std::weak_ptr<test> std_observer = original;
+	assert(lock_from_std(std_observer)->y == 4);
+	original.reset();
+	assert(!lock_from_std(std_observer).get());
+	assert(!to_std(shared_ptr<test>()));
+}
+
+struct deferred_node
+{
+	int& alive;
+	shared_ptr<deferred_node, std::function<void(void*)>, deferred_counter_policy> child;
+	weak_ptr<deferred_node, deferred_counter_policy> sibling;
+
+	deferred_node(int& alive) : alive(alive) { ++alive; }
+	~deferred_node() { --alive; }
+};
+
+void TestDeferredCounting()
+{
+	std::cout << "TestDeferredCounting.." << std::endl;
+
+	using deferred_ptr = shared_ptr<deferred_node, std::function<void(void*)>, deferred_counter_policy>;
+
+	int alive = 0;
+	deferred_ptr first(new deferred_node(alive));
+	first->child = deferred_ptr(new deferred_node(alive));
+	weak_ptr<deferred_node, deferred_counter_policy> observer = first;
+	{
+		deferred_rc_scope<> scope;
+		for (int i = 0; i < 1000; ++i)
+		{
+			deferred_ptr copy = first;
+			deferred_ptr child = copy->child;
+			assert(copy.use_count() == 2);
+		}
+		assert(scope.size() == 2);
+
+		// release is applied at the end of scope
+		first.reset();
+		assert(alive == 2 && !observer.expired());
+
+		deferred_ptr temporary(new deferred_node(alive));
+		{
+			deferred_rc_scope<> nested;
+			deferred_ptr kept = temporary;
+			temporary.reset();
+		}
+		assert(alive == 3);
+	}
+	// both the root and its child, and the temporary are disposed
+	assert(alive == 0 && observer.expired());
+
+	// many counters are indexed
+	{
+		std::vector<deferred_ptr> nodes;
+		for (int i = 0; i < 40; ++i)
+			nodes.push_back(deferred_ptr(new deferred_node(alive)));
+
+		deferred_rc_scope<> scope;
+		std::vector<deferred_ptr> copies(nodes.begin(), nodes.end());
+		assert(scope.size() == 40 && nodes[39].use_count() == 2);
+		nodes.clear();
+		copies.resize(20);
+		assert(alive == 40);
+	}
+	assert(alive == 0);
+
+	// disposing a resource releases the last observer of another one disposed at the same time
+	{
+		deferred_ptr x(new deferred_node(alive));
+		deferred_ptr w(new deferred_node(alive));
+		w->sibling = x;
+		deferred_rc_scope<> scope;
+		w.reset();
+		x.reset();
+		assert(alive == 2);
+	}
+	assert(alive == 0);
+
+	// counts are written directly out of scope
+	deferred_ptr outside(new deferred_node(alive));
+	deferred_ptr copy = outside;
+	assert(outside.use_count() == 2);
+}
+
 int main()
 {
 	TestSharedPointer();
@@ -186,6 +1340,27 @@ int main()
 	TestHashValue();
 	TestEqualValue();
 	TestEtcetra();
+	TestSharedPtrArray();
+	TestCounterPolicy();
+	TestCompactShared();
+	TestSlotHandle();
+	TestImmortalSharedPointer();
+	TestCycleCollector();
+	TestObjectPool();
+	TestCowPointer();
+	TestPersistentContainers();
+	TestSharedGroup();
+	TestInlinePointer();
+	TestOffsetPointer();
+	TestGraphSerialization();
+	TestUniqueToShared();
+	TestArrayFactory();
+	TestRcBuffer();
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+	TestSharedTask();
+#endif
+	TestStdBridge();
+	TestDeferredCounting();
 
 	return 0;
 }
@@ -0,0 +1,247 @@
+#include <cstdlib>
+#include <new>
+#include "smart_pointer_nts.h"
+
+#ifdef SMART_POINTER_NTS_PRINT_LOG
+#error allocation tests must be built without SMART_POINTER_NTS_PRINT_LOG, since logging allocates.
+#endif
+
+using namespace smart_pointer_nts;
+
+#if defined(__GNUC__) && !defined(__clang__)
+// replaced operator delete releases memory of replaced operator new by free.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+
+/// <summary>
+/// counts of global allocations.
+/// </summary>
+static size_t allocations = 0;
+static size_t deallocations = 0;
+static size_t allocated_bytes = 0;
+
+void* operator new(size_t size)
+{
+	++allocations;
+	allocated_bytes += size;
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	++allocations;
+	allocated_bytes += size;
+	size_t align = static_cast<size_t>(alignment);
+	if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (ptr)
+		++deallocations;
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+
+
+/// <summary>
+/// count allocations while running a function.
+/// </summary>
+template <class Fn>
+size_t CountAllocations(Fn&& fn)
+{
+	size_t before = allocations;
+	fn();
+	return allocations - before;
+}
+
+/// <summary>
+/// check allocation budget of an operation, and print the result.
+/// </summary>
+#define ASSERT_ALLOCATIONS(expected, ...) \
+	do \
+	{ \
+		size_t counted = CountAllocations([&]() { __VA_ARGS__; }); \
+		std::cout << "  " << #__VA_ARGS__ << ": " << counted << " allocation(s)" << std::endl; \
+		if (counted != (expected)) \
+		{ \
+			std::cout << "  expected " << (expected) << " allocation(s)" << std::endl; \
+			std::abort(); \
+		} \
+	} while (false)
+
+
+struct test
+{
+	int x = 1;
+	int y = -1;
+	test(int x = 0, int y = 0) :x(x), y(y) {}
+};
+
+
+void TestSharedPointerBudget()
+{
+	std::cout << "TestSharedPointerBudget.." << std::endl;
+
+	test* raw = new test(1, 2);
+	shared_ptr<test> adopted;
+	ASSERT_ALLOCATIONS(1, adopted = shared_ptr<test>(raw));
+
+	shared_ptr<test> made;
+	ASSERT_ALLOCATIONS(1, made = make_shared<test>(3, 4));
+
+	shared_ptr<test> copied;
+	ASSERT_ALLOCATIONS(0, copied = made);
+	ASSERT_ALLOCATIONS(0, shared_ptr<test> constructed(made));
+
+	shared_ptr<test> moved;
+	ASSERT_ALLOCATIONS(0, moved = std::move(copied));
+
+	weak_ptr<test> observer;
+	ASSERT_ALLOCATIONS(0, observer = made);
+	ASSERT_ALLOCATIONS(0, auto locked = observer.lock());
+
+	// a deleter capturing a few words stays in the small buffer of std::function, so only object and counter are allocated
+	int deleted = 0;
+	ASSERT_ALLOCATIONS(2, shared_ptr<test> custom(raw = new test, [&deleted](void* obj) { delete static_cast<test*>(obj); ++deleted; }); shared_ptr<test> copy(custom));
+
+	ASSERT_ALLOCATIONS(0, adopted.reset(); made.reset(); moved.reset(); observer.reset());
+}
+
+void TestFactoryBudget()
+{
+	std::cout << "TestFactoryBudget.." << std::endl;
+
+	ASSERT_ALLOCATIONS(1, auto array = make_shared<double[]>(100));
+	ASSERT_ALLOCATIONS(1, auto array = make_unique_for_overwrite<double[]>(100));
+
+	reserved_unique_ptr<test> reserved;
+	ASSERT_ALLOCATIONS(1, reserved = make_reserved_unique<test>(1, 2));
+	ASSERT_ALLOCATIONS(0, shared_ptr<test> promoted(std::move(reserved)));
+
+	ASSERT_ALLOCATIONS(0, auto small = make_inline<test, test>(1, 2));
+
+	rc_buffer buffer(64);
+	ASSERT_ALLOCATIONS(0, auto slice = buffer.slice(8, 16); auto copy = slice);
+
+	auto nts = make_shared<test>();
+	ASSERT_ALLOCATIONS(1, auto bridged = to_std(nts); auto back = from_std(bridged));
+}
+
+void TestObjectPoolBudget()
+{
+	std::cout << "TestObjectPoolBudget.." << std::endl;
+
+	object_pool<test> pool(4);
+	{
+		auto warm = make_pooled(pool, 1, 2);
+	}
+
+	ASSERT_ALLOCATIONS(0, auto sp = make_pooled(pool, 3, 4); auto copy = sp; sp.reset(); copy.reset());
+	ASSERT_ALLOCATIONS(0, auto up = make_pooled_unique(pool, 5, 6); up.reset());
+	ASSERT_ALLOCATIONS(0, auto sp = make_pooled(pool, 7, 8); weak_ptr<test> wp = sp; auto locked = wp.lock(); wp.reset());
+}
+
+void TestSharedPtrArrayBudget()
+{
+	std::cout << "TestSharedPtrArrayBudget.." << std::endl;
+
+	auto sp1 = make_shared<test>(1, 2);
+	auto sp2 = make_shared<test>(3, 4);
+	shared_ptr_array<test> array;
+	array.reserve(8);
+	for (int i = 0; i < 4; ++i)
+	{
+		array.push_back(sp1);
+		array.push_back(make_shared<test>());
+	}
+	array.push_back(sp2);
+
+	ASSERT_ALLOCATIONS(0, auto element = array[0]);
+	ASSERT_ALLOCATIONS(0, array.count_expired());
+	ASSERT_ALLOCATIONS(0, array.remove_expired());
+	ASSERT_ALLOCATIONS(0, array.erase(0, 2));
+	ASSERT_ALLOCATIONS(0, array.clear());
+}
+
+void TestBytesPerPointer()
+{
+	std::cout << "TestBytesPerPointer.." << std::endl;
+
+	std::cout << "  shared_ptr: " << sizeof(shared_ptr<test>) << " bytes" << std::endl;
+	std::cout << "  weak_ptr: " << sizeof(weak_ptr<test>) << " bytes" << std::endl;
+	std::cout << "  unique_ptr: " << sizeof(unique_ptr<test>) << " bytes" << std::endl;
+	std::cout << "  counter: " << sizeof(SharedPtrRefCounter) << " bytes" << std::endl;
+
+	size_t before = allocated_bytes;
+	auto made = make_shared<test>();
+	std::cout << "  make_shared<test>: " << allocated_bytes - before << " bytes for " << sizeof(test) << " bytes object" << std::endl;
+}
+
+int main()
+{
+	TestSharedPointerBudget();
+	TestFactoryBudget();
+	TestObjectPoolBudget();
+	TestSharedPtrArrayBudget();
+	TestBytesPerPointer();
+
+	if (allocations < deallocations)
+	{
+		std::cout << "deallocated more than allocated" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}